@@ -0,0 +1,845 @@
+#pragma once
+
+#include "mc.h"
+
+#include <map>
+#include <memory>
+#include <tuple>
+
+// Funciones implícitas construidas como árbol CSG / expresión y compiladas a
+// una cinta de instrucciones. La cinta se evalúa por lotes sin llamadas
+// virtuales por nodo y, por bloque, se poda con aritmética de intervalos.
+
+// Intervalo cerrado [lo, hi] para acotar la función sobre un bloque
+struct Interval {
+  double lo, hi;
+
+  Interval() : lo(0), hi(0) {}
+  Interval(double v) : lo(v), hi(v) {}
+  Interval(double lo, double hi) : lo(lo), hi(hi) {}
+
+  static Interval all() { return Interval(-INFINITY, INFINITY); }
+};
+
+// Si algún extremo es NaN (inf - inf, 0 * inf) no se puede acotar nada
+inline Interval checked(double lo, double hi) {
+  if (isnan(lo) || isnan(hi)) return Interval::all();
+  return Interval(lo, hi);
+}
+
+inline Interval operator+(const Interval &a, const Interval &b) { return checked(a.lo + b.lo, a.hi + b.hi); }
+inline Interval operator-(const Interval &a, const Interval &b) { return checked(a.lo - b.hi, a.hi - b.lo); }
+inline Interval operator-(const Interval &a) { return Interval(-a.hi, -a.lo); }
+
+inline Interval operator*(const Interval &a, const Interval &b) {
+  double p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+  for (double v : p) if (isnan(v)) return Interval::all();
+  return Interval(min(min(p[0], p[1]), min(p[2], p[3])), max(max(p[0], p[1]), max(p[2], p[3])));
+}
+
+inline Interval operator/(const Interval &a, const Interval &b) {
+  if (b.lo <= 0 && b.hi >= 0) return Interval::all();
+  return a * Interval(1.0 / b.hi, 1.0 / b.lo);
+}
+
+inline Interval abs(const Interval &a) {
+  if (a.lo >= 0) return a;
+  if (a.hi <= 0) return -a;
+  return Interval(0, max(-a.lo, a.hi));
+}
+
+inline Interval min(const Interval &a, const Interval &b) { return Interval(min(a.lo, b.lo), min(a.hi, b.hi)); }
+inline Interval max(const Interval &a, const Interval &b) { return Interval(max(a.lo, b.lo), max(a.hi, b.hi)); }
+
+inline Interval sqrt(const Interval &a) {
+  if (a.hi < 0) return Interval::all();
+  return Interval(sqrt(max(a.lo, 0.0)), sqrt(a.hi));
+}
+
+inline Interval sin(const Interval &a) {
+  if (!(a.hi - a.lo < 2 * M_PI)) return Interval(-1, 1);
+  double lo = min(sin(a.lo), sin(a.hi));
+  double hi = max(sin(a.lo), sin(a.hi));
+  // Máximos en pi/2 + 2*pi*n y mínimos en -pi/2 + 2*pi*n
+  if (M_PI / 2 + 2 * M_PI * ceil((a.lo - M_PI / 2) / (2 * M_PI)) <= a.hi) hi = 1;
+  if (-M_PI / 2 + 2 * M_PI * ceil((a.lo + M_PI / 2) / (2 * M_PI)) <= a.hi) lo = -1;
+  return Interval(lo, hi);
+}
+
+inline Interval cos(const Interval &a) { return sin(Interval(a.lo + M_PI / 2, a.hi + M_PI / 2)); }
+
+// Potencia con exponente constante; solo se acota la rama creciente
+inline Interval pow(const Interval &a, double k) {
+  if (k > 0 && a.lo >= 0) return Interval(pow(a.lo, k), pow(a.hi, k));
+  return Interval::all();
+}
+
+template <typename T>
+inline T square(T a) { return a * a; }
+
+inline Interval square(const Interval &a) {
+  Interval m = abs(a);
+  return Interval(m.lo * m.lo, m.hi * m.hi);
+}
+
+// Primitivas: p apunta a sus parámetros en el pool de constantes
+
+// Esfera con distancia con signo. p = cx, cy, cz, r
+template <typename T>
+inline T csgSphere(T x, T y, T z, const double* p) {
+  return sqrt(square(x - T(p[0])) + square(y - T(p[1])) + square(z - T(p[2]))) - T(p[3]);
+}
+
+// Caja redondeada. p = cx, cy, cz, hx, hy, hz, radio
+template <typename T>
+inline T csgBox(T x, T y, T z, const double* p) {
+  T zero = T(0);
+  T qx = abs(x - T(p[0])) - T(p[3]);
+  T qy = abs(y - T(p[1])) - T(p[4]);
+  T qz = abs(z - T(p[2])) - T(p[5]);
+  T outside = sqrt(square(max(qx, zero)) + square(max(qy, zero)) + square(max(qz, zero)));
+  return outside + min(max(max(qx, qy), qz), zero) - T(p[6]);
+}
+
+// Toro alrededor del eje y. p = cx, cy, cz, R, r
+template <typename T>
+inline T csgTorus(T x, T y, T z, const double* p) {
+  T dx = x - T(p[0]);
+  T dz = z - T(p[2]);
+  T q = sqrt(square(dx) + square(dz)) - T(p[3]);
+  return sqrt(square(q) + square(y - T(p[1]))) - T(p[4]);
+}
+
+// Gyroid como en GyroidFunction. p = cx, cy, cz, escala, grosor
+template <typename T>
+inline T csgGyroid(T x, T y, T z, const double* p) {
+  T dx = (x - T(p[0])) * T(p[3]);
+  T dy = (y - T(p[1])) * T(p[3]);
+  T dz = (z - T(p[2])) * T(p[3]);
+  return abs(sin(dx) * cos(dy) + sin(dy) * cos(dz) + sin(dz) * cos(dx)) - T(p[4]);
+}
+
+// Metaballs como en MetaballFunction. p = n, umbral, (cx, cy, cz, r) * n
+template <typename T>
+inline T csgMetaball(T x, T y, T z, const double* p) {
+  int n = (int)p[0];
+  T sum = T(0);
+  for (int i = 0; i < n; ++i) {
+    const double* b = p + 2 + 4 * i;
+    T dx = x - T(b[0]);
+    T dy = y - T(b[1]);
+    T dz = z - T(b[2]);
+    T dist_sq = dx*dx + dy*dy + dz*dz;
+    T r_sq = T(b[3]) * T(b[3]);
+    if (dist_sq < r_sq * T(4.0)) {
+      sum += r_sq / (dist_sq + T(0.0001));
+    }
+  }
+  return T(p[1]) - sum;
+}
+
+inline Interval csgMetaball(Interval x, Interval y, Interval z, const double* p) {
+  int n = (int)p[0];
+  double lo = 0.0, hi = 0.0;
+  for (int i = 0; i < n; ++i) {
+    const double* b = p + 2 + 4 * i;
+    Interval d = square(x - b[0]) + square(y - b[1]) + square(z - b[2]);
+    double r_sq = b[3] * b[3];
+    if (d.lo < r_sq * 4.0) hi += r_sq / (d.lo + 0.0001);
+    if (d.hi < r_sq * 4.0) lo += r_sq / (d.hi + 0.0001);
+  }
+  return Interval(p[1] - hi, p[1] - lo);
+}
+
+template <typename T>
+inline T csgSmoothUnion(T a, T b, double k) {
+  T h = max(T(k) - abs(a - b), T(0)) / T(k);
+  return min(a, b) - h * h * T(k) * T(0.25);
+}
+
+// Resta suave de b a a (smoothSubtract(b, a) de ComplexHybridFunction)
+template <typename T>
+inline T csgSmoothSubtract(T a, T b, double k) {
+  T h = max(T(k) - abs(-b - a), T(0)) / T(k);
+  return max(-b, a) + h * h * T(k) * T(0.25);
+}
+
+enum class CsgOp : uint8_t {
+  Const, X, Y, Z,
+  Add, Sub, Mul, Div, AddK, MulK, PowK,
+  Neg, Abs, Sqrt, Sin, Cos,
+  Min, Max, SmoothUnion, SmoothSubtract,
+  Sphere, Box, Torus, Gyroid, Metaball,
+  // Solo en el árbol: transformaciones del dominio
+  Translate, Twist
+};
+
+// Nodo del árbol de expresión. Los nodos son inmutables y se pueden compartir.
+struct CsgNode {
+  CsgOp op;
+  vector<shared_ptr<const CsgNode>> children;
+  vector<double> params;
+};
+
+typedef shared_ptr<const CsgNode> CsgExpr;
+
+// Constructores del árbol
+class Csg {
+private:
+  static CsgExpr node(CsgOp op, vector<CsgExpr> children, vector<double> params = {}) {
+    return make_shared<CsgNode>(CsgNode{op, move(children), move(params)});
+  }
+
+public:
+  static CsgExpr constant(double v) { return node(CsgOp::Const, {}, {v}); }
+  static CsgExpr x() { return node(CsgOp::X, {}); }
+  static CsgExpr y() { return node(CsgOp::Y, {}); }
+  static CsgExpr z() { return node(CsgOp::Z, {}); }
+
+  static CsgExpr add(CsgExpr a, CsgExpr b) { return node(CsgOp::Add, {a, b}); }
+  static CsgExpr sub(CsgExpr a, CsgExpr b) { return node(CsgOp::Sub, {a, b}); }
+  static CsgExpr mul(CsgExpr a, CsgExpr b) { return node(CsgOp::Mul, {a, b}); }
+  static CsgExpr div(CsgExpr a, CsgExpr b) { return node(CsgOp::Div, {a, b}); }
+  static CsgExpr add(CsgExpr a, double k) { return node(CsgOp::AddK, {a}, {k}); }
+  static CsgExpr mul(CsgExpr a, double k) { return node(CsgOp::MulK, {a}, {k}); }
+  static CsgExpr pow(CsgExpr a, double k) { return node(CsgOp::PowK, {a}, {k}); }
+  static CsgExpr neg(CsgExpr a) { return node(CsgOp::Neg, {a}); }
+  static CsgExpr abs(CsgExpr a) { return node(CsgOp::Abs, {a}); }
+  static CsgExpr sqrt(CsgExpr a) { return node(CsgOp::Sqrt, {a}); }
+  static CsgExpr sin(CsgExpr a) { return node(CsgOp::Sin, {a}); }
+  static CsgExpr cos(CsgExpr a) { return node(CsgOp::Cos, {a}); }
+  static CsgExpr min(CsgExpr a, CsgExpr b) { return node(CsgOp::Min, {a, b}); }
+  static CsgExpr max(CsgExpr a, CsgExpr b) { return node(CsgOp::Max, {a, b}); }
+
+  static CsgExpr sphere(double cx, double cy, double cz, double r) {
+    return node(CsgOp::Sphere, {x(), y(), z()}, {cx, cy, cz, r});
+  }
+
+  static CsgExpr box(double cx, double cy, double cz, double hx, double hy, double hz, double radius = 0.0) {
+    return node(CsgOp::Box, {x(), y(), z()}, {cx, cy, cz, hx, hy, hz, radius});
+  }
+
+  static CsgExpr torus(double cx, double cy, double cz, double major_radius, double minor_radius) {
+    return node(CsgOp::Torus, {x(), y(), z()}, {cx, cy, cz, major_radius, minor_radius});
+  }
+
+  static CsgExpr gyroid(double cx, double cy, double cz, double scale, double thickness) {
+    return node(CsgOp::Gyroid, {x(), y(), z()}, {cx, cy, cz, scale, thickness});
+  }
+
+  static CsgExpr metaballs(const vector<Point> &centers, const vector<double> &radii, double threshold = 1.0) {
+    vector<double> params = {(double)centers.size(), threshold};
+    for (size_t i = 0; i < centers.size(); ++i) {
+      params.insert(params.end(), {centers[i].X(), centers[i].Y(), centers[i].Z(), radii[i]});
+    }
+    return node(CsgOp::Metaball, {x(), y(), z()}, params);
+  }
+
+  static CsgExpr unite(CsgExpr a, CsgExpr b) { return min(a, b); }
+  static CsgExpr intersect(CsgExpr a, CsgExpr b) { return max(a, b); }
+  static CsgExpr subtract(CsgExpr a, CsgExpr b) { return max(a, neg(b)); }
+  static CsgExpr smoothUnion(CsgExpr a, CsgExpr b, double k) { return node(CsgOp::SmoothUnion, {a, b}, {k}); }
+  static CsgExpr smoothSubtract(CsgExpr a, CsgExpr b, double k) { return node(CsgOp::SmoothSubtract, {a, b}, {k}); }
+
+  // Evalúa a en (x - dx, y - dy, z - dz)
+  static CsgExpr translate(CsgExpr a, double dx, double dy, double dz) {
+    return node(CsgOp::Translate, {a}, {dx, dy, dz});
+  }
+
+  // Evalúa a con el plano xz rotado amount * y radianes
+  static CsgExpr twist(CsgExpr a, double amount) { return node(CsgOp::Twist, {a}, {amount}); }
+};
+
+// Lee una expresión CSG escrita como s-expresión, por ejemplo
+//   (smooth_union 10 (torus 0 0 0 70 20) (sphere 0 40 0 35))
+// Las primitivas toman sus parámetros numéricos; los números sueltos donde se
+// espera una expresión son constantes y x, y, z son las coordenadas.
+class CsgParser {
+private:
+  string text;
+  size_t pos = 0;
+  string error;
+
+  void skipSpace() {
+    while (pos < text.size()) {
+      if (isspace((unsigned char)text[pos])) {
+        ++pos;
+      } else if (text[pos] == ';') {
+        while (pos < text.size() && text[pos] != '\n') ++pos;
+      } else {
+        break;
+      }
+    }
+  }
+
+  string token() {
+    skipSpace();
+    size_t start = pos;
+    while (pos < text.size() && !isspace((unsigned char)text[pos]) && text[pos] != '(' && text[pos] != ')') ++pos;
+    return text.substr(start, pos - start);
+  }
+
+  bool fail(const string &message) {
+    if (error.empty()) error = message + " (posición " + to_string(pos) + ")";
+    return false;
+  }
+
+  bool peek(char c) {
+    skipSpace();
+    return pos < text.size() && text[pos] == c;
+  }
+
+  bool number(double &value) {
+    string word = token();
+    char* end = nullptr;
+    value = strtod(word.c_str(), &end);
+    if (word.empty() || *end != '\0') return fail("se esperaba un número en lugar de '" + word + "'");
+    return true;
+  }
+
+  bool numbers(vector<double> &values, size_t count) {
+    values.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      if (!number(values[i])) return false;
+    }
+    return true;
+  }
+
+  // Expresiones hasta el ')' que cierra la lista actual
+  bool operands(vector<CsgExpr> &out, size_t minimum, size_t maximum) {
+    while (!peek(')')) {
+      if (pos >= text.size()) return fail("falta ')'");
+      CsgExpr e = expression();
+      if (!e) return false;
+      out.push_back(e);
+    }
+    if (out.size() < minimum || out.size() > maximum) return fail("cantidad de operandos inválida");
+    return true;
+  }
+
+  CsgExpr expression() {
+    if (!peek('(')) {
+      string word = token();
+      if (word == "x") return Csg::x();
+      if (word == "y") return Csg::y();
+      if (word == "z") return Csg::z();
+      char* end = nullptr;
+      double value = strtod(word.c_str(), &end);
+      if (word.empty() || *end != '\0') {
+        fail("término inesperado '" + word + "'");
+        return nullptr;
+      }
+      return Csg::constant(value);
+    }
+    ++pos;
+    string op = token();
+    vector<double> p;
+    vector<CsgExpr> e;
+    CsgExpr result;
+
+    if (op == "sphere") {
+      if (numbers(p, 4)) result = Csg::sphere(p[0], p[1], p[2], p[3]);
+    } else if (op == "box") {
+      if (numbers(p, 6)) {
+        double radius = 0.0;
+        if (!peek(')') && !number(radius)) return nullptr;
+        result = Csg::box(p[0], p[1], p[2], p[3], p[4], p[5], radius);
+      }
+    } else if (op == "torus") {
+      if (numbers(p, 5)) result = Csg::torus(p[0], p[1], p[2], p[3], p[4]);
+    } else if (op == "gyroid") {
+      if (numbers(p, 5)) result = Csg::gyroid(p[0], p[1], p[2], p[3], p[4]);
+    } else if (op == "metaballs") {
+      // (metaballs threshold  x y z r  x y z r ...)
+      double threshold;
+      vector<Point> centers;
+      vector<double> radii;
+      if (!number(threshold)) return nullptr;
+      while (!peek(')')) {
+        if (!numbers(p, 4)) return nullptr;
+        centers.push_back(Point(p[0], p[1], p[2]));
+        radii.push_back(p[3]);
+      }
+      result = Csg::metaballs(centers, radii, threshold);
+    } else if (op == "union" || op == "intersect" || op == "min" || op == "max" || op == "+" || op == "*") {
+      if (operands(e, 2, SIZE_MAX)) {
+        result = e[0];
+        for (size_t i = 1; i < e.size(); ++i) {
+          if (op == "union" || op == "min") result = Csg::unite(result, e[i]);
+          else if (op == "intersect" || op == "max") result = Csg::intersect(result, e[i]);
+          else if (op == "+") result = Csg::add(result, e[i]);
+          else result = Csg::mul(result, e[i]);
+        }
+      }
+    } else if (op == "subtract" || op == "-" || op == "/") {
+      if (operands(e, 2, 2)) {
+        if (op == "subtract") result = Csg::subtract(e[0], e[1]);
+        else if (op == "-") result = Csg::sub(e[0], e[1]);
+        else result = Csg::div(e[0], e[1]);
+      }
+    } else if (op == "smooth_union" || op == "smooth_subtract") {
+      if (numbers(p, 1) && operands(e, 2, 2)) {
+        result = op == "smooth_union" ? Csg::smoothUnion(e[0], e[1], p[0]) : Csg::smoothSubtract(e[0], e[1], p[0]);
+      }
+    } else if (op == "translate") {
+      if (numbers(p, 3) && operands(e, 1, 1)) result = Csg::translate(e[0], p[0], p[1], p[2]);
+    } else if (op == "twist") {
+      if (numbers(p, 1) && operands(e, 1, 1)) result = Csg::twist(e[0], p[0]);
+    } else if (op == "pow") {
+      // El exponente va después de la base: (pow a k)
+      CsgExpr base = expression();
+      if (base && numbers(p, 1)) result = Csg::pow(base, p[0]);
+    } else if (op == "neg" || op == "abs" || op == "sqrt" || op == "sin" || op == "cos") {
+      if (operands(e, 1, 1)) {
+        if (op == "neg") result = Csg::neg(e[0]);
+        else if (op == "abs") result = Csg::abs(e[0]);
+        else if (op == "sqrt") result = Csg::sqrt(e[0]);
+        else if (op == "sin") result = Csg::sin(e[0]);
+        else result = Csg::cos(e[0]);
+      }
+    } else {
+      fail("operación desconocida '" + op + "'");
+    }
+
+    if (!result) return nullptr;
+    if (!peek(')')) {
+      fail("falta ')' después de '" + op + "'");
+      return nullptr;
+    }
+    ++pos;
+    return result;
+  }
+
+public:
+  // Devuelve nullptr y deja el motivo en error si el texto no es válido
+  static CsgExpr parse(const string &text, string &error) {
+    CsgParser parser;
+    parser.text = text;
+    CsgExpr result = parser.expression();
+    if (result && (parser.skipSpace(), parser.pos != text.size())) {
+      parser.fail("texto sobrante después de la expresión");
+      result = nullptr;
+    }
+    error = parser.error;
+    return result;
+  }
+};
+
+// Instrucción de la cinta. Cada instrucción escribe el registro de su índice.
+struct CsgInstr {
+  CsgOp op;
+  int a, b, c;     // Registros de entrada
+  double k;        // Constante inmediata
+  int params;      // Desplazamiento en el pool de constantes
+};
+
+struct CsgTape {
+  vector<CsgInstr> code;
+  vector<double> pool;
+
+  int output() const { return (int)code.size() - 1; }
+};
+
+// Cantidad de constantes que usa la instrucción en el pool
+inline int csgParamCount(const CsgInstr &in, const double* pool) {
+  switch (in.op) {
+    case CsgOp::Sphere: return 4;
+    case CsgOp::Box: return 7;
+    case CsgOp::Torus: return 5;
+    case CsgOp::Gyroid: return 5;
+    case CsgOp::Metaball: return 2 + 4 * (int)pool[in.params];
+    default: return 0;
+  }
+}
+
+// Evalúa una instrucción sobre registros escalares (double o Interval)
+template <typename T>
+inline T csgApply(const CsgInstr &in, const T* r, const double* pool, T x, T y, T z) {
+  const double* p = pool + in.params;
+  switch (in.op) {
+    case CsgOp::Const: return T(in.k);
+    case CsgOp::X: return x;
+    case CsgOp::Y: return y;
+    case CsgOp::Z: return z;
+    case CsgOp::Add: return r[in.a] + r[in.b];
+    case CsgOp::Sub: return r[in.a] - r[in.b];
+    case CsgOp::Mul: return r[in.a] * r[in.b];
+    case CsgOp::Div: return r[in.a] / r[in.b];
+    case CsgOp::AddK: return r[in.a] + T(in.k);
+    case CsgOp::MulK: return r[in.a] * T(in.k);
+    case CsgOp::PowK: return pow(r[in.a], in.k);
+    case CsgOp::Neg: return -r[in.a];
+    case CsgOp::Abs: return abs(r[in.a]);
+    case CsgOp::Sqrt: return sqrt(r[in.a]);
+    case CsgOp::Sin: return sin(r[in.a]);
+    case CsgOp::Cos: return cos(r[in.a]);
+    case CsgOp::Min: return min(r[in.a], r[in.b]);
+    case CsgOp::Max: return max(r[in.a], r[in.b]);
+    case CsgOp::SmoothUnion: return csgSmoothUnion(r[in.a], r[in.b], in.k);
+    case CsgOp::SmoothSubtract: return csgSmoothSubtract(r[in.a], r[in.b], in.k);
+    case CsgOp::Sphere: return csgSphere(r[in.a], r[in.b], r[in.c], p);
+    case CsgOp::Box: return csgBox(r[in.a], r[in.b], r[in.c], p);
+    case CsgOp::Torus: return csgTorus(r[in.a], r[in.b], r[in.c], p);
+    case CsgOp::Gyroid: return csgGyroid(r[in.a], r[in.b], r[in.c], p);
+    case CsgOp::Metaball: return csgMetaball(r[in.a], r[in.b], r[in.c], p);
+    default: return T(0);
+  }
+}
+
+// Evalúa la cinta sobre n <= CSG_BATCH puntos. regs tiene code.size() * CSG_BATCH
+// elementos; cada instrucción es un bucle simple sobre los puntos del lote.
+const int CSG_BATCH = 64;
+
+template <typename T>
+void csgRunBatch(const CsgTape &tape, T* regs, const T* xs, const T* ys, const T* zs, T* out, int n) {
+  const double* pool = tape.pool.data();
+  for (size_t r = 0; r < tape.code.size(); ++r) {
+    const CsgInstr &in = tape.code[r];
+    T* o = regs + r * CSG_BATCH;
+    const T* A = regs + (size_t)in.a * CSG_BATCH;
+    const T* B = regs + (size_t)in.b * CSG_BATCH;
+    const T* C = regs + (size_t)in.c * CSG_BATCH;
+    const double* p = pool + in.params;
+    T k = T(in.k);
+    switch (in.op) {
+      case CsgOp::Const: for (int l = 0; l < n; ++l) o[l] = k; break;
+      case CsgOp::X: copy(xs, xs + n, o); break;
+      case CsgOp::Y: copy(ys, ys + n, o); break;
+      case CsgOp::Z: copy(zs, zs + n, o); break;
+      case CsgOp::Add: for (int l = 0; l < n; ++l) o[l] = A[l] + B[l]; break;
+      case CsgOp::Sub: for (int l = 0; l < n; ++l) o[l] = A[l] - B[l]; break;
+      case CsgOp::Mul: for (int l = 0; l < n; ++l) o[l] = A[l] * B[l]; break;
+      case CsgOp::Div: for (int l = 0; l < n; ++l) o[l] = A[l] / B[l]; break;
+      case CsgOp::AddK: for (int l = 0; l < n; ++l) o[l] = A[l] + k; break;
+      case CsgOp::MulK: for (int l = 0; l < n; ++l) o[l] = A[l] * k; break;
+      case CsgOp::PowK: for (int l = 0; l < n; ++l) o[l] = pow(A[l], k); break;
+      case CsgOp::Neg: for (int l = 0; l < n; ++l) o[l] = -A[l]; break;
+      case CsgOp::Abs: for (int l = 0; l < n; ++l) o[l] = abs(A[l]); break;
+      case CsgOp::Sqrt: for (int l = 0; l < n; ++l) o[l] = sqrt(A[l]); break;
+      case CsgOp::Sin: for (int l = 0; l < n; ++l) o[l] = sin(A[l]); break;
+      case CsgOp::Cos: for (int l = 0; l < n; ++l) o[l] = cos(A[l]); break;
+      case CsgOp::Min: for (int l = 0; l < n; ++l) o[l] = min(A[l], B[l]); break;
+      case CsgOp::Max: for (int l = 0; l < n; ++l) o[l] = max(A[l], B[l]); break;
+      case CsgOp::SmoothUnion: for (int l = 0; l < n; ++l) o[l] = csgSmoothUnion(A[l], B[l], in.k); break;
+      case CsgOp::SmoothSubtract: for (int l = 0; l < n; ++l) o[l] = csgSmoothSubtract(A[l], B[l], in.k); break;
+      case CsgOp::Sphere: for (int l = 0; l < n; ++l) o[l] = csgSphere(A[l], B[l], C[l], p); break;
+      case CsgOp::Box: for (int l = 0; l < n; ++l) o[l] = csgBox(A[l], B[l], C[l], p); break;
+      case CsgOp::Torus: for (int l = 0; l < n; ++l) o[l] = csgTorus(A[l], B[l], C[l], p); break;
+      case CsgOp::Gyroid: for (int l = 0; l < n; ++l) o[l] = csgGyroid(A[l], B[l], C[l], p); break;
+      case CsgOp::Metaball: for (int l = 0; l < n; ++l) o[l] = csgMetaball(A[l], B[l], C[l], p); break;
+      default: break;
+    }
+  }
+  const T* result = regs + (size_t)tape.output() * CSG_BATCH;
+  copy(result, result + n, out);
+}
+
+// Compilador del árbol a la cinta, con plegado de constantes y reutilización
+// de subárboles compartidos
+class CsgCompiler {
+private:
+  CsgTape tape;
+  vector<bool> isConst;
+  map<tuple<const CsgNode*, int, int, int>, int> memo;
+
+  int emit(CsgInstr in, const vector<double> &params = {}) {
+    in.params = (int)tape.pool.size();
+    tape.pool.insert(tape.pool.end(), params.begin(), params.end());
+
+    // Si todas las entradas son constantes, plegar a una constante
+    bool foldable = in.op != CsgOp::X && in.op != CsgOp::Y && in.op != CsgOp::Z && in.op != CsgOp::Const;
+    int inputs[3] = {in.a, in.b, in.c};
+    for (int r : inputs) {
+      if (r >= 0 && !isConst[r]) foldable = false;
+    }
+    if (foldable) {
+      vector<double> values(tape.code.size());
+      for (size_t r = 0; r < tape.code.size(); ++r) values[r] = tape.code[r].k;
+      double v = csgApply<double>(in, values.data(), tape.pool.data(), 0, 0, 0);
+      tape.pool.resize(in.params);
+      return constant(v);
+    }
+
+    tape.code.push_back(in);
+    isConst.push_back(in.op == CsgOp::Const);
+    return (int)tape.code.size() - 1;
+  }
+
+  int constant(double v) {
+    CsgInstr in = {CsgOp::Const, -1, -1, -1, v, 0};
+    tape.code.push_back(in);
+    isConst.push_back(true);
+    return (int)tape.code.size() - 1;
+  }
+
+  bool isConstant(int r, double v) const { return isConst[r] && tape.code[r].k == v; }
+
+  int unary(CsgOp op, int a, double k = 0) { return emit({op, a, -1, -1, k, 0}); }
+  int binary(CsgOp op, int a, int b, double k = 0) { return emit({op, a, b, -1, k, 0}); }
+
+  int compile(const CsgExpr &node, int rx, int ry, int rz) {
+    auto key = make_tuple(node.get(), rx, ry, rz);
+    auto it = memo.find(key);
+    if (it != memo.end()) return it->second;
+
+    int result = compileNode(*node, rx, ry, rz);
+    memo[key] = result;
+    return result;
+  }
+
+  int compileNode(const CsgNode &node, int rx, int ry, int rz) {
+    const vector<double> &p = node.params;
+    auto child = [&](int i) { return compile(node.children[i], rx, ry, rz); };
+
+    switch (node.op) {
+      case CsgOp::Const: return constant(p[0]);
+      case CsgOp::X: return rx;
+      case CsgOp::Y: return ry;
+      case CsgOp::Z: return rz;
+
+      case CsgOp::AddK: {
+        int a = child(0);
+        return p[0] == 0.0 ? a : unary(CsgOp::AddK, a, p[0]);
+      }
+      case CsgOp::MulK: {
+        int a = child(0);
+        return p[0] == 1.0 ? a : unary(CsgOp::MulK, a, p[0]);
+      }
+      case CsgOp::Add: {
+        int a = child(0), b = child(1);
+        if (isConstant(a, 0.0)) return b;
+        if (isConstant(b, 0.0)) return a;
+        return binary(CsgOp::Add, a, b);
+      }
+      case CsgOp::Mul: {
+        int a = child(0), b = child(1);
+        if (isConstant(a, 1.0)) return b;
+        if (isConstant(b, 1.0)) return a;
+        if (isConst[a]) return unary(CsgOp::MulK, b, tape.code[a].k);
+        if (isConst[b]) return unary(CsgOp::MulK, a, tape.code[b].k);
+        return binary(CsgOp::Mul, a, b);
+      }
+      case CsgOp::Sub: case CsgOp::Div: case CsgOp::Min: case CsgOp::Max:
+        return binary(node.op, child(0), child(1));
+      case CsgOp::SmoothUnion: case CsgOp::SmoothSubtract:
+        return binary(node.op, child(0), child(1), p[0]);
+      case CsgOp::PowK:
+        return unary(CsgOp::PowK, child(0), p[0]);
+      case CsgOp::Neg: case CsgOp::Abs: case CsgOp::Sqrt: case CsgOp::Sin: case CsgOp::Cos:
+        return unary(node.op, child(0));
+
+      case CsgOp::Sphere: case CsgOp::Box: case CsgOp::Torus: case CsgOp::Gyroid: case CsgOp::Metaball:
+        return emit({node.op, child(0), child(1), child(2), 0, 0}, p);
+
+      case CsgOp::Translate: {
+        int tx = p[0] == 0.0 ? rx : unary(CsgOp::AddK, rx, -p[0]);
+        int ty = p[1] == 0.0 ? ry : unary(CsgOp::AddK, ry, -p[1]);
+        int tz = p[2] == 0.0 ? rz : unary(CsgOp::AddK, rz, -p[2]);
+        return compile(node.children[0], tx, ty, tz);
+      }
+      case CsgOp::Twist: {
+        if (p[0] == 0.0) return child(0);
+        int angle = unary(CsgOp::MulK, ry, p[0]);
+        int c = unary(CsgOp::Cos, angle);
+        int s = unary(CsgOp::Sin, angle);
+        int tx = binary(CsgOp::Sub, binary(CsgOp::Mul, c, rx), binary(CsgOp::Mul, s, rz));
+        int tz = binary(CsgOp::Add, binary(CsgOp::Mul, s, rx), binary(CsgOp::Mul, c, rz));
+        return compile(node.children[0], tx, ry, tz);
+      }
+    }
+    return constant(0.0);
+  }
+
+public:
+  CsgTape run(const CsgExpr &root) {
+    int x = emit({CsgOp::X, -1, -1, -1, 0, 0});
+    int y = emit({CsgOp::Y, -1, -1, -1, 0, 0});
+    int z = emit({CsgOp::Z, -1, -1, -1, 0, 0});
+    int out = compile(root, x, y, z);
+    return compact(tape, out, vector<int>());
+  }
+
+  // Elimina el código muerto desde out y renumera los registros. alias[r],
+  // si existe y es >= 0, reemplaza el registro r por otro equivalente.
+  static CsgTape compact(const CsgTape &source, int out, const vector<int> &alias) {
+    auto resolve = [&alias](int r) {
+      while (r >= 0 && r < (int)alias.size() && alias[r] >= 0) r = alias[r];
+      return r;
+    };
+
+    int n = (int)source.code.size();
+    vector<bool> live(n, false);
+    live[resolve(out)] = true;
+    for (int r = n - 1; r >= 0; --r) {
+      if (!live[r]) continue;
+      const CsgInstr &in = source.code[r];
+      for (int input : {in.a, in.b, in.c}) {
+        if (input >= 0) live[resolve(input)] = true;
+      }
+    }
+
+    CsgTape result;
+    vector<int> renumber(n, -1);
+    for (int r = 0; r < n; ++r) {
+      if (!live[r]) continue;
+      CsgInstr in = source.code[r];
+      for (int* input : {&in.a, &in.b, &in.c}) {
+        if (*input >= 0) *input = renumber[resolve(*input)];
+      }
+      renumber[r] = (int)result.code.size();
+      result.code.push_back(in);
+    }
+    result.pool = source.pool;
+    return result;
+  }
+};
+
+// Función implícita definida por un árbol CSG compilado
+class CsgFunction : public ImplicitFunction {
+private:
+  CsgTape tape;
+
+  // Especializa la cinta para un bloque: las ramas de min/max y uniones
+  // suaves que no pueden ganar dentro del bloque se eliminan, y de cada
+  // metaball se quitan los blobs cuya influencia no llega al bloque.
+  CsgTape prune(const BrickRegion &brick) const {
+    Point lo = brick.minCorner();
+    Point hi = brick.maxCorner();
+    Interval x(lo.X(), hi.X()), y(lo.Y(), hi.Y()), z(lo.Z(), hi.Z());
+
+    int n = (int)tape.code.size();
+    vector<Interval> bounds(n);
+    vector<int> alias(n, -1);
+    CsgTape pruned;
+    pruned.code = tape.code;
+
+    auto margin = [](const Interval &a, const Interval &b) {
+      return 1e-9 * (1.0 + max(max(abs(a.lo), abs(a.hi)), max(abs(b.lo), abs(b.hi))));
+    };
+
+    for (int r = 0; r < n; ++r) {
+      CsgInstr &in = pruned.code[r];
+      bounds[r] = csgApply<Interval>(in, bounds.data(), tape.pool.data(), x, y, z);
+
+      // Las constantes de la cinta podada se copian a su propio pool
+      if (in.op == CsgOp::Metaball) {
+        pruneBlobs(pruned.pool, in, tape.pool.data(), bounds[in.a], bounds[in.b], bounds[in.c]);
+        continue;
+      }
+      int count = csgParamCount(in, tape.pool.data());
+      const double* params = tape.pool.data() + in.params;
+      in.params = (int)pruned.pool.size();
+      pruned.pool.insert(pruned.pool.end(), params, params + count);
+
+      if (in.a < 0 || in.b < 0) continue;
+
+      const Interval &A = bounds[in.a];
+      const Interval &B = bounds[in.b];
+      double eps = margin(A, B);
+      switch (in.op) {
+        case CsgOp::Min:
+          if (A.lo >= B.hi + eps) alias[r] = in.b;
+          else if (B.lo >= A.hi + eps) alias[r] = in.a;
+          break;
+        case CsgOp::Max:
+          if (A.lo >= B.hi + eps) alias[r] = in.a;
+          else if (B.lo >= A.hi + eps) alias[r] = in.b;
+          break;
+        case CsgOp::SmoothUnion:
+          if (A.lo - B.hi >= in.k + eps) alias[r] = in.b;
+          else if (B.lo - A.hi >= in.k + eps) alias[r] = in.a;
+          break;
+        case CsgOp::SmoothSubtract:
+          if (A.lo + B.lo >= in.k + eps) alias[r] = in.a;
+          else if (-B.hi - A.hi >= in.k + eps) in = {CsgOp::Neg, in.b, -1, -1, 0.0, 0};
+          break;
+        default:
+          break;
+      }
+    }
+
+    return CsgCompiler::compact(pruned, tape.output(), alias);
+  }
+
+  // Copia al pool solo los blobs que pueden aportar dentro del bloque
+  static void pruneBlobs(vector<double> &pool, CsgInstr &in, const double* source,
+                         const Interval &x, const Interval &y, const Interval &z) {
+    const double* p = source + in.params;
+    int count = (int)p[0];
+    in.params = (int)pool.size();
+    pool.insert(pool.end(), {0.0, p[1]});
+    for (int i = 0; i < count; ++i) {
+      const double* b = p + 2 + 4 * i;
+      Interval d = square(x - b[0]) + square(y - b[1]) + square(z - b[2]);
+      if (d.lo < b[3] * b[3] * 4.0) {
+        pool.insert(pool.end(), b, b + 4);
+        pool[in.params] += 1.0;
+      }
+    }
+  }
+
+  template <typename T>
+  void runPoints(const CsgTape &t, const T* xs, const T* ys, const T* zs, T* out, int n) const {
+    thread_local vector<T> regs;
+    regs.resize(t.code.size() * CSG_BATCH);
+    for (int start = 0; start < n; start += CSG_BATCH) {
+      int count = min(CSG_BATCH, n - start);
+      csgRunBatch(t, regs.data(), xs + start, ys + start, zs + start, out + start, count);
+    }
+  }
+
+  template <typename T>
+  void sampleBrickAs(const BrickRegion &brick, T* out) const {
+    CsgTape pruned = prune(brick);
+    size_t n = brick.points();
+    vector<T> xs(n), ys(n), zs(n);
+    size_t idx = 0;
+    for (int i = 0; i < brick.nx; ++i) {
+      for (int j = 0; j < brick.ny; ++j) {
+        for (int k = 0; k < brick.nz; ++k, ++idx) {
+          xs[idx] = T((brick.i0 + i) * brick.spacing);
+          ys[idx] = T((brick.j0 + j) * brick.spacing);
+          zs[idx] = T((brick.k0 + k) * brick.spacing);
+        }
+      }
+    }
+    runPoints(pruned, xs.data(), ys.data(), zs.data(), out, (int)n);
+  }
+
+public:
+  CsgFunction(const CsgExpr &root) : tape(CsgCompiler().run(root)) {}
+
+  // Número de instrucciones de la cinta completa y de la podada para un bloque
+  size_t size() const { return tape.code.size(); }
+  size_t size(const BrickRegion &brick) const { return prune(brick).code.size(); }
+
+  string cacheKey() const override {
+    vector<double> params;
+    for (const CsgInstr &in : tape.code) {
+      params.insert(params.end(), {(double)in.op, (double)in.a, (double)in.b, (double)in.c, in.k, (double)in.params});
+    }
+    params.insert(params.end(), tape.pool.begin(), tape.pool.end());
+    return functionKey("csg", params);
+  }
+
+  double evaluate(double x, double y, double z) const override {
+    thread_local vector<double> regs;
+    regs.resize(tape.code.size());
+    for (size_t r = 0; r < tape.code.size(); ++r) {
+      regs[r] = csgApply<double>(tape.code[r], regs.data(), tape.pool.data(), x, y, z);
+    }
+    return regs[tape.output()];
+  }
+
+  void evaluateBatch(const double* xs, const double* ys, const double* zs, double* out, int n) const override {
+    runPoints(tape, xs, ys, zs, out, n);
+  }
+
+  void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const override {
+    runPoints(tape, xs, ys, zs, out, n);
+  }
+
+  void sampleBrick(const BrickRegion &brick, double* out) const override { sampleBrickAs(brick, out); }
+
+  void sampleBrickFloat(const BrickRegion &brick, float* out) const override { sampleBrickAs(brick, out); }
+};
@@ -1,63 +1,385 @@
-#include "mc.h"
-
-int main() {
-  int domain = 512;
-  int delta = 4;  
-  string filename = "heart.ply";
-
-  // ========== FUNCIONES BÁSICAS ==========
-  
-  // 1. Esfera
-  // Sphere sphere(domain / 2.0, domain / 2.0, domain / 2.0, domain * (100.0 / 256.0));
-  // MarchingCubes mc(domain, delta, "sphere.ply", &sphere);
-  
-  // 2. Toro
-  // TorusFunction torus(domain / 2.0, domain / 2.0, domain / 2.0, 70.0, 20.0);
-  // MarchingCubes mc(domain, delta, "torus.ply", &torus);
-  
-  // 3. Cubo Redondeado
-  // RoundedCubeFunction roundedCube(domain / 2.0, domain / 2.0, domain / 2.0, 150.0, 15.0);
-  // MarchingCubes mc(domain, delta, "rounded_cube.ply", &roundedCube);
-
-  // ========== FUNCIONES AVANZADAS ==========
-  
-  // 4. Gyroid (superficie mínima periódica)
-  // GyroidFunction gyroid(domain / 2.0, domain / 2.0, domain / 2.0, 0.15, 0.2);
-  // MarchingCubes mc(domain, delta, "gyroid.ply", &gyroid);
-  
-  // 5. Metaballs (blobs orgánicos)
-  vector<Point> centers = {
-    Point(200, 256, 256),
-    Point(312, 256, 256),
-    Point(256, 200, 300),
-    Point(256, 312, 300),
-    Point(256, 256, 200)
+#include "csg.h"
+#include "writers.h"
+
+#include <cerrno>
+#include <climits>
+#include <memory>
+#include <set>
+
+// Uso: mc [--opción valor ...] [--job archivo]
+//
+// Cada opción también se puede escribir en un archivo de trabajos como
+// "opción = valor"; una línea vacía separa un trabajo del siguiente y las
+// opciones de la línea de comandos valen como defaults para todos. Una
+// opción desconocida o un valor que no se puede leer es un error.
+//
+//   field      sphere | torus | rounded_cube | gyroid | metaballs | mandelbulb
+//              | heart | heart_simple | complex_hybrid | csg   (metaballs)
+//   params     parámetros del constructor separados por comas; por defecto
+//              centrados en el dominio y escalados a su lado menor.
+//              metaballs: umbral, x, y, z, r, ...
+//   expr       expresión CSG para field = csg, p. ej.
+//              (smooth_union 10 (torus 256 256 256 70 20) (sphere 256 296 256 35))
+//   domain     X o X,Y,Z                                      (512)
+//   delta      separación entre muestras, puede no ser entera (4)
+//   iso        uno o más iso-valores separados por comas      (0)
+//   engine     sequential | parallel | cached | adaptive      (sequential)
+//   precision  double | float | int16 para cached y adaptive  (double)
+//   threads    hilos para parallel, cached y adaptive         (todos)
+//   cache      directorio del caché de campos en disco
+//   format     ply | stl | obj | mcz                          (ply)
+//   output     archivo de salida                              (<field>.<format>)
+//   write_threads  con más de 1, la salida se arma en paralelo y se
+//              escribe con pwrite                             (1)
+//   profile    archivo CSV al que se agrega una línea por malla
+//   name       nombre del trabajo en el perfil                (field)
+
+typedef map<string, string> JobOptions;
+
+const set<string> knownOptions = {
+  "field", "params", "expr", "domain", "delta", "iso", "engine", "precision", "threads",
+  "cache", "format", "output", "write_threads", "profile", "name"};
+
+// El número tiene que ocupar todo el texto, salvo espacios alrededor
+bool parseNumber(const string &text, double &value) {
+  const char* begin = text.c_str();
+  char* end = nullptr;
+  errno = 0;
+  value = strtod(begin, &end);
+  if (end == begin || errno == ERANGE || !isfinite(value)) return false;
+  while (*end == ' ' || *end == '\t') ++end;
+  return *end == '\0';
+}
+
+bool parseInteger(const string &text, int &value) {
+  const char* begin = text.c_str();
+  char* end = nullptr;
+  errno = 0;
+  long parsed = strtol(begin, &end, 10);
+  if (end == begin || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) return false;
+  while (*end == ' ' || *end == '\t') ++end;
+  value = (int)parsed;
+  return *end == '\0';
+}
+
+// Números separados por comas; falla si alguno no lo es
+bool parseList(const string &text, vector<double> &values) {
+  values.clear();
+  if (text.find_first_not_of(" \t") == string::npos) return true;
+  stringstream in(text + ",");
+  string item;
+  while (getline(in, item, ',')) {
+    double value;
+    if (!parseNumber(item, value)) return false;
+    values.push_back(value);
+  }
+  return true;
+}
+
+// Construye la función pedida; sin params usa los valores de siempre
+// centrados en el dominio y escalados a su lado menor (referidos a 512)
+unique_ptr<ImplicitFunction> buildField(const JobOptions &job, const Point &extent, string &error) {
+  string field = job.at("field");
+  vector<double> p;
+  if (!parseList(job.count("params") ? job.at("params") : "", p)) {
+    error = "params inválido: " + job.at("params");
+    return nullptr;
+  }
+  double cx = extent.X() / 2.0, cy = extent.Y() / 2.0, cz = extent.Z() / 2.0;
+  double size = min(extent.X(), min(extent.Y(), extent.Z()));
+  double s = size / 512.0;
+
+  auto defaults = [&](vector<double> values) {
+    for (size_t i = p.size(); i < values.size(); ++i) p.push_back(values[i]);
   };
-  vector<double> radii = {40.0, 35.0, 45.0, 38.0, 42.0};
-  MetaballFunction metaballs(centers, radii, 1.5);
-  MarchingCubes mc(domain, delta, "metaballs.ply", &metaballs);
-  
-  // 6. Mandelbulb (fractal 3D - requiere delta pequeño y puede ser lento)
-  // int delta_fractal = 4;
-  // MandelbulbFunction mandelbulb(domain / 2.0, domain / 2.0, domain / 2.0, 8.0, 15, 2.0);
-  // MarchingCubes mc(domain, delta_fractal, "mandelbulb.ply", &mandelbulb);
-  
-  // 7. Corazón 3D (versión mejorada más estable)
-  // HeartFunction heart(domain / 2.0, domain / 2.0, domain / 2.0, 100.0);
-  // MarchingCubes mc(domain, delta, "heart.ply", &heart);
-  
-  // 7b. Corazón 3D versión simple (más robusta, prueba esta si la anterior tiene artefactos)
-  // HeartFunctionSimple heart_simple(domain / 2.0, domain / 2.0, domain / 2.0, 100.0);
-  // MarchingCubes mc(domain, delta, "heart_simple.ply", &heart_simple);
-  
-  // 8. Función Híbrida Compleja (la más compleja - combina toro, esferas, cubo, gyroid, ondas)
-  // ComplexHybridFunction complexShape(domain / 2.0, domain / 2.0, domain / 2.0, 0.5);
-  // MarchingCubes mc(domain, delta, "complex_hybrid.ply", &complexShape);
-
-  // ========== GENERAR Y EXPORTAR ==========
-  
-  mc.generateMesh();
-  mc.exportPly();
 
+  if (field == "sphere") {
+    defaults({cx, cy, cz, size * (100.0 / 256.0)});
+    return unique_ptr<ImplicitFunction>(new Sphere(p[0], p[1], p[2], p[3]));
+  }
+  if (field == "torus") {
+    defaults({cx, cy, cz, 70.0 * s, 20.0 * s});
+    return unique_ptr<ImplicitFunction>(new TorusFunction(p[0], p[1], p[2], p[3], p[4]));
+  }
+  if (field == "rounded_cube") {
+    defaults({cx, cy, cz, 150.0 * s, 15.0 * s});
+    return unique_ptr<ImplicitFunction>(new RoundedCubeFunction(p[0], p[1], p[2], p[3], p[4]));
+  }
+  if (field == "gyroid") {
+    defaults({cx, cy, cz, 0.15 / s, 0.2});
+    return unique_ptr<ImplicitFunction>(new GyroidFunction(p[0], p[1], p[2], p[3], p[4]));
+  }
+  if (field == "metaballs") {
+    if (p.empty()) {
+      p = {1.5,
+           cx - 56 * s, cy, cz, 40.0 * s,
+           cx + 56 * s, cy, cz, 35.0 * s,
+           cx, cy - 56 * s, cz + 44 * s, 45.0 * s,
+           cx, cy + 56 * s, cz + 44 * s, 38.0 * s,
+           cx, cy, cz - 56 * s, 42.0 * s};
+    }
+    if (p.size() < 5 || (p.size() - 1) % 4 != 0) {
+      error = "metaballs espera umbral, x, y, z, r, ...";
+      return nullptr;
+    }
+    vector<Point> centers;
+    vector<double> radii;
+    for (size_t i = 1; i < p.size(); i += 4) {
+      centers.push_back(Point(p[i], p[i + 1], p[i + 2]));
+      radii.push_back(p[i + 3]);
+    }
+    return unique_ptr<ImplicitFunction>(new MetaballFunction(centers, radii, p[0]));
+  }
+  if (field == "mandelbulb") {
+    defaults({cx, cy, cz, 8.0, 15, 2.0});
+    if (p[4] < 0 || p[4] > INT_MAX) {
+      error = "cantidad de iteraciones fuera de rango";
+      return nullptr;
+    }
+    return unique_ptr<ImplicitFunction>(new MandelbulbFunction(p[0], p[1], p[2], p[3], (int)p[4], p[5]));
+  }
+  if (field == "heart") {
+    defaults({cx, cy, cz, 100.0 * s});
+    return unique_ptr<ImplicitFunction>(new HeartFunction(p[0], p[1], p[2], p[3]));
+  }
+  if (field == "heart_simple") {
+    defaults({cx, cy, cz, 100.0 * s});
+    return unique_ptr<ImplicitFunction>(new HeartFunctionSimple(p[0], p[1], p[2], p[3]));
+  }
+  if (field == "complex_hybrid") {
+    defaults({cx, cy, cz, 0.5});
+    return unique_ptr<ImplicitFunction>(new ComplexHybridFunction(p[0], p[1], p[2], p[3]));
+  }
+  if (field == "csg") {
+    if (!job.count("expr")) {
+      error = "field = csg necesita expr";
+      return nullptr;
+    }
+    CsgExpr root = CsgParser::parse(job.at("expr"), error);
+    if (!root) return nullptr;
+    return unique_ptr<ImplicitFunction>(new CsgFunction(root));
+  }
+
+  error = "función desconocida '" + field + "'";
+  return nullptr;
+}
+
+// Con varios iso-valores cada malla va a su propio archivo
+string outputName(const string &output, const vector<double> &isos, size_t n) {
+  if (isos.size() < 2) return output;
+  ostringstream suffix;
+  suffix << "_iso" << isos[n];
+  // El punto de la extensión, solo en el nombre del archivo
+  size_t slash = output.rfind('/');
+  size_t dot = output.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) return output + suffix.str();
+  return output.substr(0, dot) + suffix.str() + output.substr(dot);
+}
+
+void appendProfile(const JobOptions &job, const vector<double> &isos, size_t n,
+                   const MeshArena &mesh, double seconds) {
+  const string &path = job.at("profile");
+  bool header = false;
+  {
+    ifstream existing(path);
+    header = !existing.good() || existing.peek() == ifstream::traits_type::eof();
+  }
+  ofstream out(path, ios::app);
+  if (header) out << "job,field,engine,precision,threads,domain,delta,iso,triangles,vertices,seconds\n";
+  out << job.at("name") << "," << job.at("field") << "," << job.at("engine") << ","
+      << job.at("precision") << "," << job.at("threads") << ",\"" << job.at("domain") << "\","
+      << job.at("delta") << "," << isos[n] << "," << mesh.triangles() << "," << mesh.vertices() << ","
+      << seconds << "\n";
+}
+
+int runJob(JobOptions job) {
+  // Defaults de lo que no dijeron ni el trabajo ni la línea de comandos
+  const JobOptions defaults = {
+    {"field", "metaballs"}, {"domain", "512"}, {"delta", "4"}, {"iso", "0"},
+    {"engine", "sequential"}, {"precision", "double"}, {"format", "ply"}, {"write_threads", "1"},
+    {"threads", to_string(max(1u, thread::hardware_concurrency()))}};
+  for (const auto &entry : defaults) job.insert(entry);
+  if (!job.count("output")) job["output"] = job["field"] + "." + job["format"];
+  if (!job.count("name")) job["name"] = job["field"];
+
+  vector<double> domain, isos;
+  bool domainOk = parseList(job["domain"], domain);
+  if (domain.size() == 1) domain.resize(3, domain[0]);
+  if (!domainOk || domain.size() != 3 || domain[0] <= 0 || domain[1] <= 0 || domain[2] <= 0) {
+    cerr << "domain inválido: " << job["domain"] << "\n";
+    return 1;
+  }
+  double delta;
+  if (!parseNumber(job["delta"], delta) || delta <= 0) {
+    cerr << "delta inválido: " << job["delta"] << "\n";
+    return 1;
+  }
+  for (double size : domain) {
+    if (MarchingCubes::cellsAlong(size, delta) > MarchingCubes::MAX_DIVISIONS) {
+      cerr << "delta demasiado chico para domain " << job["domain"] << ": " << job["delta"] << "\n";
+      return 1;
+    }
+  }
+  if (!parseList(job["iso"], isos)) {
+    cerr << "iso inválido: " << job["iso"] << "\n";
+    return 1;
+  }
+  if (isos.empty()) isos.push_back(0.0);
+  int threads, writeThreads;
+  if (!parseInteger(job["threads"], threads) || threads < 1) {
+    cerr << "threads inválido: " << job["threads"] << "\n";
+    return 1;
+  }
+  if (!parseInteger(job["write_threads"], writeThreads) || writeThreads < 1) {
+    cerr << "write_threads inválido: " << job["write_threads"] << "\n";
+    return 1;
+  }
+
+  const string &engine = job["engine"];
+  if (engine != "sequential" && engine != "parallel" && engine != "cached" && engine != "adaptive") {
+    cerr << "engine desconocido: " << engine << "\n";
+    return 1;
+  }
+  Precision precision;
+  if (job["precision"] == "double") precision = Precision::Double;
+  else if (job["precision"] == "float") precision = Precision::Float;
+  else if (job["precision"] == "int16") precision = Precision::Int16;
+  else {
+    cerr << "precision desconocida: " << job["precision"] << "\n";
+    return 1;
+  }
+  unique_ptr<MeshWriter> writer = MeshWriter::create(job["format"]);
+  if (!writer) {
+    cerr << "format desconocido: " << job["format"] << "\n";
+    return 1;
+  }
+  auto save = [&](const MeshArena &mesh, const string &name) {
+    if (writer->write(mesh, name, writeThreads)) return true;
+    cerr << "No se pudo escribir " << name << "\n";
+    return false;
+  };
+
+  Point extent(domain[0], domain[1], domain[2]);
+  string error;
+  unique_ptr<ImplicitFunction> func = buildField(job, extent, error);
+  if (!func) {
+    cerr << job["name"] << ": " << error << "\n";
+    return 1;
+  }
+
+  MarchingCubes mc(extent, delta, job["output"], func.get());
+  mc.setThreads(threads);
+  if (job.count("cache")) {
+    if (mkdir(job["cache"].c_str(), 0755) != 0 && errno != EEXIST) {
+      cerr << "No se pudo crear " << job["cache"] << ": " << strerror(errno) << "\n";
+      return 1;
+    }
+    mc.setFieldCache(job["cache"]);
+  }
+
+  cout << "== " << job["name"] << ": " << job["field"] << ", " << engine << ", domain " << job["domain"]
+       << ", delta " << delta << "\n";
+
+  if (engine == "adaptive") {
+    // Un solo muestreo para todos los iso-valores
+    vector<MeshArena> meshes = mc.generateMeshes(isos, precision);
+    for (size_t n = 0; n < meshes.size(); ++n) {
+      if (!save(meshes[n], outputName(job["output"], isos, n))) return 1;
+      if (job.count("profile")) appendProfile(job, isos, n, meshes[n], mc.elapsedSeconds() / meshes.size());
+    }
+    return 0;
+  }
+
+  for (size_t n = 0; n < isos.size(); ++n) {
+    mc.setIsoValue(isos[n]);
+    if (engine == "sequential") mc.generateMesh();
+    else if (engine == "parallel") mc.generateMeshParallel();
+    else mc.generateMeshCached(precision);
+
+    if (!save(mc.getMesh(), outputName(job["output"], isos, n))) return 1;
+    if (job.count("profile")) appendProfile(job, isos, n, mc.getMesh(), mc.elapsedSeconds());
+  }
   return 0;
-}
\ No newline at end of file
+}
+
+string trim(const string &text) {
+  size_t first = text.find_first_not_of(" \t\r");
+  if (first == string::npos) return "";
+  size_t last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+// Un trabajo por bloque de líneas "clave = valor"; '#' comenta
+bool readJobs(const string &path, const JobOptions &base, vector<JobOptions> &jobs) {
+  ifstream in(path);
+  if (!in) {
+    cerr << "No se pudo abrir " << path << "\n";
+    return false;
+  }
+  JobOptions current = base;
+  bool open = false;
+  string line;
+  int number = 0;
+  while (getline(in, line)) {
+    ++number;
+    line = trim(line);
+    if (!line.empty() && line[0] == '#') continue;
+    if (line.empty()) {
+      if (open) jobs.push_back(current);
+      current = base;
+      open = false;
+      continue;
+    }
+    size_t eq = line.find('=');
+    if (eq == string::npos) {
+      cerr << path << ":" << number << ": se esperaba clave = valor\n";
+      return false;
+    }
+    string key = trim(line.substr(0, eq));
+    if (!knownOptions.count(key)) {
+      cerr << path << ":" << number << ": opción desconocida '" << key << "'\n";
+      return false;
+    }
+    current[key] = trim(line.substr(eq + 1));
+    open = true;
+  }
+  if (open) jobs.push_back(current);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  JobOptions base;
+  string jobFile;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      cout << "Uso: mc [--field f] [--params a,b,...] [--expr s-expr] [--domain X[,Y,Z]] [--delta d]\n"
+              "        [--iso v[,v...]] [--engine sequential|parallel|cached|adaptive]\n"
+              "        [--precision double|float|int16] [--threads n] [--cache dir]\n"
+              "        [--format ply|stl|obj|mcz] [--write_threads n] [--output archivo]\n"
+              "        [--profile archivo.csv] [--name n]\n"
+              "        [--job archivo]\n";
+      return 0;
+    }
+    if (arg.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+      cerr << "Argumento inválido: " << arg << " (ver --help)\n";
+      return 1;
+    }
+    if (arg == "--job") {
+      jobFile = argv[++i];
+    } else if (knownOptions.count(arg.substr(2))) {
+      base[arg.substr(2)] = argv[++i];
+    } else {
+      cerr << "Opción desconocida: " << arg << " (ver --help)\n";
+      return 1;
+    }
+  }
+
+  vector<JobOptions> jobs;
+  if (jobFile.empty()) jobs.push_back(base);
+  else if (!readJobs(jobFile, base, jobs)) return 1;
+
+  int failures = 0;
+  for (const JobOptions &job : jobs) failures += runJob(job);
+  return failures == 0 ? 0 : 1;
+}
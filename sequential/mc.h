@@ -1,11 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #define pii pair<int, int>
@@ -321,19 +337,19 @@ public:
   double Y() const { return y; }
   double Z() const { return z; }
 
-  Point operator+(const Point &p) {
+  Point operator+(const Point &p) const {
     return Point(this->x + p.x, this->y + p.y, this->z + p.z);
   }
 
-  Point operator-(const Point &p) {
+  Point operator-(const Point &p) const {
     return Point(this->x - p.x, this->y - p.y, this->z - p.z);
   }
 
-  Point operator*(double scalar) {
+  Point operator*(double scalar) const {
     return Point(this->x * scalar, this->y * scalar, this->z * scalar);
   }
 
-  Point operator/(double scalar) {
+  Point operator/(double scalar) const {
     return Point(this->x / scalar, this->y / scalar, this->z / scalar);
   }
 
@@ -343,30 +359,265 @@ public:
   }
 };
 
-class Triangle {
+// Capacidad fija de cada página de malla (índices locales de 16 bits)
+const int MESH_PAGE_VERTICES = 8192;
+const int MESH_PAGE_INDICES = 3 * 8192;
+
+// Máximo que puede emitir un cubo: 12 aristas y 5 triángulos
+const int CELL_MAX_VERTICES = 12;
+const int CELL_MAX_INDICES = 15;
+
+// Página de malla: bloque fijo de vértices e índices enlazado con la siguiente.
+// Los índices son locales a la página, así que las páginas se pueden mover
+// entre mallas sin reescribirlas.
+struct MeshPage {
+  Point vertices[MESH_PAGE_VERTICES];
+  uint16_t indices[MESH_PAGE_INDICES];
+  int vertexCount = 0;
+  int indexCount = 0;
+  MeshPage* next = nullptr;
+};
+
+// Pool de páginas: las páginas liberadas se reciclan entre corridas y frames
+// en lugar de volver al sistema. Es uno solo para todos los hilos, porque
+// parallelFor crea hilos nuevos en cada llamada y un pool por hilo dejaría
+// las páginas que libera el hilo que limpia las mallas fuera de su alcance.
+// Se toma una página por vez: el candado es despreciable frente a llenarla, y
+// ningún hilo retiene páginas que otro tenga que pedir al sistema.
+class MeshPagePool {
+private:
+  vector<MeshPage*> freePages;
+  size_t allocatedPages = 0;
+
+  MeshPagePool() {}
+
+  static mutex& lock() {
+    static mutex pageLock;
+    return pageLock;
+  }
+
+  static MeshPagePool& instance() {
+    static MeshPagePool pool;
+    return pool;
+  }
+
+public:
+  ~MeshPagePool() {
+    for (MeshPage* page : freePages) delete page;
+  }
+
+  static MeshPage* acquire() {
+    MeshPage* page = nullptr;
+    {
+      lock_guard<mutex> guard(lock());
+      vector<MeshPage*> &pages = instance().freePages;
+      if (!pages.empty()) {
+        page = pages.back();
+        pages.pop_back();
+      } else {
+        ++instance().allocatedPages;
+      }
+    }
+    if (page == nullptr) return new MeshPage();
+    page->vertexCount = 0;
+    page->indexCount = 0;
+    page->next = nullptr;
+    return page;
+  }
+
+  // Devuelve una lista enlazada de páginas
+  static void releaseChain(MeshPage* head) {
+    lock_guard<mutex> guard(lock());
+    vector<MeshPage*> &pages = instance().freePages;
+    for (MeshPage* page = head; page;) {
+      MeshPage* next = page->next;
+      pages.push_back(page);
+      page = next;
+    }
+  }
+
+  static size_t pooled() {
+    lock_guard<mutex> guard(lock());
+    return instance().freePages.size();
+  }
+
+  // Páginas pedidas al sistema desde el inicio, libres o en uso
+  static size_t allocated() {
+    lock_guard<mutex> guard(lock());
+    return instance().allocatedPages;
+  }
+};
+
+// Malla de salida como lista enlazada de páginas. Crecer nunca copia lo ya
+// escrito y unir dos mallas es O(1).
+class MeshArena {
 private:
-  Point p1, p2, p3;
+  MeshPage* head = nullptr;
+  MeshPage* tail = nullptr;
+  size_t vertexTotal = 0;
+  size_t triangleTotal = 0;
 
 public:
-  Triangle() {}
-  Triangle(Point p1, Point p2, Point p3) : p1(p1), p2(p2), p3(p3) {}
+  MeshArena() {}
+  MeshArena(const MeshArena&) = delete;
+  MeshArena& operator=(const MeshArena&) = delete;
+  MeshArena(MeshArena&& other) { *this = move(other); }
+  MeshArena& operator=(MeshArena&& other) {
+    if (this != &other) {
+      clear();
+      head = other.head;
+      tail = other.tail;
+      vertexTotal = other.vertexTotal;
+      triangleTotal = other.triangleTotal;
+      other.head = other.tail = nullptr;
+      other.vertexTotal = other.triangleTotal = 0;
+    }
+    return *this;
+  }
+  ~MeshArena() { clear(); }
+
+  size_t vertices() const { return vertexTotal; }
+  size_t triangles() const { return triangleTotal; }
+  bool empty() const { return triangleTotal == 0; }
+  const MeshPage* pages() const { return head; }
+
+  // Devuelve una página con espacio para un cubo completo
+  MeshPage* reserveCell() {
+    if (tail == nullptr ||
+        tail->vertexCount + CELL_MAX_VERTICES > MESH_PAGE_VERTICES ||
+        tail->indexCount + CELL_MAX_INDICES > MESH_PAGE_INDICES) {
+      MeshPage* page = MeshPagePool::acquire();
+      if (tail) tail->next = page; else head = page;
+      tail = page;
+    }
+    return tail;
+  }
+
+  // Confirma lo escrito en la página devuelta por reserveCell
+  void commitCell(int newVertices, int newIndices) {
+    tail->vertexCount += newVertices;
+    tail->indexCount += newIndices;
+    vertexTotal += newVertices;
+    triangleTotal += newIndices / 3;
+  }
 
-  Point P1() { return p1; }
-  Point P2() { return p2; }
-  Point P3() { return p3; }
+  void addTriangle(const Point& p1, const Point& p2, const Point& p3) {
+    MeshPage* page = reserveCell();
+    int base = page->vertexCount;
+    page->vertices[base] = p1;
+    page->vertices[base + 1] = p2;
+    page->vertices[base + 2] = p3;
+    for (int i = 0; i < 3; ++i) page->indices[page->indexCount + i] = base + i;
+    commitCell(3, 3);
+  }
 
-  void getPly(fstream &plyfile) {
-    plyfile << p1 << "\n";
-    plyfile << p2 << "\n";
-    plyfile << p3 << "\n";
+  // Mueve las páginas de other al final de esta malla sin copiarlas
+  void splice(MeshArena& other) {
+    if (other.head == nullptr) return;
+    if (tail) tail->next = other.head; else head = other.head;
+    tail = other.tail;
+    vertexTotal += other.vertexTotal;
+    triangleTotal += other.triangleTotal;
+    other.head = other.tail = nullptr;
+    other.vertexTotal = other.triangleTotal = 0;
   }
+
+  // Recorre los triángulos con índices globales de vértice
+  template <typename F>
+  void forEachTriangle(F&& f) const {
+    size_t base = 0;
+    for (const MeshPage* page = head; page; page = page->next) {
+      for (int i = 0; i < page->indexCount; i += 3) {
+        f(base + page->indices[i], base + page->indices[i + 1], base + page->indices[i + 2]);
+      }
+      base += page->vertexCount;
+    }
+  }
+
+  // Devuelve las páginas al pool
+  void clear() {
+    if (head) MeshPagePool::releaseChain(head);
+    head = nullptr;
+    tail = nullptr;
+    vertexTotal = triangleTotal = 0;
+  }
+};
+
+// Bloque de puntos de la rejilla [i0, i0+nx) x [j0, j0+ny) x [k0, k0+nz),
+// con el punto (i, j, k) en (i*spacing, j*spacing, k*spacing)
+struct BrickRegion {
+  int i0, j0, k0;
+  int nx, ny, nz;
+  double spacing;
+
+  size_t points() const { return (size_t)nx * ny * nz; }
+  Point minCorner() const { return Point(i0 * spacing, j0 * spacing, k0 * spacing); }
+  Point maxCorner() const { return Point((i0 + nx - 1) * spacing, (j0 + ny - 1) * spacing, (k0 + nz - 1) * spacing); }
 };
 
+// Clave textual de una función: tipo y parámetros exactos en hexadecimal
+inline string functionKey(const string &type, const vector<double> &params) {
+  ostringstream key;
+  key << type << hexfloat;
+  for (double p : params) key << ' ' << p;
+  return key.str();
+}
+
 // Clase abstracta para funciones implicitas
 class ImplicitFunction {
 public:
   virtual ~ImplicitFunction() = default;
   virtual double evaluate(double x, double y, double z) const = 0;
+
+  // Identifica la función y sus parámetros para la caché en disco; vacía si
+  // la función no se puede cachear
+  virtual string cacheKey() const { return ""; }
+
+  // Mayor iso-valor que se va a extraer del muestreo por bloques. Las
+  // funciones que podan bloques lejos de la superficie lo usan como umbral;
+  // el motor lo fija antes de muestrear, en INFINITY para no podar.
+  virtual void setCullLevel(double) {}
+
+  // Evalúa n puntos de una vez; las funciones pueden sobrescribirla con un
+  // kernel vectorizado
+  virtual void evaluateBatch(const double* xs, const double* ys, const double* zs, double* out, int n) const {
+    for (int i = 0; i < n; ++i) out[i] = evaluate(xs[i], ys[i], zs[i]);
+  }
+
+  // Versión float32; por defecto evalúa en double y redondea el resultado
+  virtual void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const {
+    for (int i = 0; i < n; ++i) out[i] = (float)evaluate(xs[i], ys[i], zs[i]);
+  }
+
+  // Muestrea todos los puntos de un bloque (z contiguo). Las funciones pueden
+  // sobrescribirla para especializarse o podar trabajo por bloque.
+  virtual void sampleBrick(const BrickRegion &brick, double* out) const {
+    sampleBrickRows(brick, out, [this](const double* xs, const double* ys, const double* zs, double* row, int n) {
+      evaluateBatch(xs, ys, zs, row, n);
+    });
+  }
+
+  virtual void sampleBrickFloat(const BrickRegion &brick, float* out) const {
+    sampleBrickRows(brick, out, [this](const float* xs, const float* ys, const float* zs, float* row, int n) {
+      evaluateBatchFloat(xs, ys, zs, row, n);
+    });
+  }
+
+protected:
+  // Recorre el bloque fila a fila a lo largo de z
+  template <typename T, typename F>
+  static void sampleBrickRows(const BrickRegion &brick, T* out, F&& evaluateRow) {
+    vector<T> xs(brick.nz), ys(brick.nz), zs(brick.nz);
+    for (int k = 0; k < brick.nz; ++k) zs[k] = T((brick.k0 + k) * brick.spacing);
+    for (int i = 0; i < brick.nx; ++i) {
+      fill(xs.begin(), xs.end(), T((brick.i0 + i) * brick.spacing));
+      for (int j = 0; j < brick.ny; ++j) {
+        fill(ys.begin(), ys.end(), T((brick.j0 + j) * brick.spacing));
+        evaluateRow(xs.data(), ys.data(), zs.data(), out, brick.nz);
+        out += brick.nz;
+      }
+    }
+  }
 };
 
 // Funcion de la esfera: (x-cx)^2 + (y-cy)^2 + (z-cz)^2 - r^2 = 0
@@ -378,8 +629,21 @@ public:
   Sphere() {}
   Sphere(double cx, double cy, double cz, double r) : center(cx, cy, cz), radius(r) {}
   
-  double evaluate(double x, double y, double z) const override {
-    return pow(x - center.X(), 2) + pow(y - center.Y(), 2) + pow(z - center.Z(), 2) - pow(radius, 2);
+  template <typename T>
+  T field(T x, T y, T z) const {
+    T dx = x - T(center.X());
+    T dy = y - T(center.Y());
+    T dz = z - T(center.Z());
+    T r = T(radius);
+    return dx*dx + dy*dy + dz*dz - r*r;
+  }
+
+  string cacheKey() const override { return functionKey("sphere", {center.X(), center.Y(), center.Z(), radius}); }
+
+  double evaluate(double x, double y, double z) const override { return field<double>(x, y, z); }
+
+  void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const override {
+    for (int i = 0; i < n; ++i) out[i] = field<float>(xs[i], ys[i], zs[i]);
   }
 };
 
@@ -394,12 +658,22 @@ public:
   TorusFunction(double cx, double cy, double cz, double major_radius, double minor_radius)
     : cx(cx), cy(cy), cz(cz), R(major_radius), r(minor_radius) {}
   
-  double evaluate(double x, double y, double z) const override {
-    double dx = x - cx;
-    double dy = y - cy;
-    double dz = z - cz;
-    double sum_sq = dx*dx + dy*dy + dz*dz;
-    return pow(sum_sq + R*R - r*r, 2) - 4*R*R*(dx*dx + dz*dz);
+  template <typename T>
+  T field(T x, T y, T z) const {
+    T dx = x - T(cx);
+    T dy = y - T(cy);
+    T dz = z - T(cz);
+    T sum_sq = dx*dx + dy*dy + dz*dz;
+    T a = sum_sq + T(R*R) - T(r*r);
+    return a*a - T(4*R*R)*(dx*dx + dz*dz);
+  }
+
+  string cacheKey() const override { return functionKey("torus", {cx, cy, cz, R, r}); }
+
+  double evaluate(double x, double y, double z) const override { return field<double>(x, y, z); }
+
+  void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const override {
+    for (int i = 0; i < n; ++i) out[i] = field<float>(xs[i], ys[i], zs[i]);
   }
 };
 
@@ -414,22 +688,32 @@ public:
   RoundedCubeFunction(double cx, double cy, double cz, double size, double radius)
     : cx(cx), cy(cy), cz(cz), size(size), radius(radius) {}
   
-  double evaluate(double x, double y, double z) const override {
-    double dx = abs(x - cx);
-    double dy = abs(y - cy);
-    double dz = abs(z - cz);
-    double half_size = size / 2.0;
+  template <typename T>
+  T field(T x, T y, T z) const {
+    T dx = abs(x - T(cx));
+    T dy = abs(y - T(cy));
+    T dz = abs(z - T(cz));
+    T half_size = T(size / 2.0);
     
-    double qx = dx - half_size;
-    double qy = dy - half_size;
-    double qz = dz - half_size;
+    T qx = dx - half_size;
+    T qy = dy - half_size;
+    T qz = dz - half_size;
     
-    double max_q = max(max(qx, qy), qz);
-    double length_pos = sqrt(max(qx, 0.0)*max(qx, 0.0) + 
-                             max(qy, 0.0)*max(qy, 0.0) + 
-                             max(qz, 0.0)*max(qz, 0.0));
+    T zero = T(0);
+    T max_q = max(max(qx, qy), qz);
+    T length_pos = sqrt(max(qx, zero)*max(qx, zero) + 
+                        max(qy, zero)*max(qy, zero) + 
+                        max(qz, zero)*max(qz, zero));
     
-    return length_pos + min(max_q, 0.0) - radius;
+    return length_pos + min(max_q, zero) - T(radius);
+  }
+
+  string cacheKey() const override { return functionKey("rounded_cube", {cx, cy, cz, size, radius}); }
+
+  double evaluate(double x, double y, double z) const override { return field<double>(x, y, z); }
+
+  void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const override {
+    for (int i = 0; i < n; ++i) out[i] = field<float>(xs[i], ys[i], zs[i]);
   }
 };
 
@@ -444,30 +728,175 @@ public:
   GyroidFunction(double cx, double cy, double cz, double scale, double thickness)
     : cx(cx), cy(cy), cz(cz), scale(scale), thickness(thickness) {}
   
-  double evaluate(double x, double y, double z) const override {
-    double dx = (x - cx) * scale;
-    double dy = (y - cy) * scale;
-    double dz = (z - cz) * scale;
+  template <typename T>
+  T field(T x, T y, T z) const {
+    T dx = (x - T(cx)) * T(scale);
+    T dy = (y - T(cy)) * T(scale);
+    T dz = (z - T(cz)) * T(scale);
     
-    double gyroid = sin(dx) * cos(dy) + sin(dy) * cos(dz) + sin(dz) * cos(dx);
-    return abs(gyroid) - thickness;
+    T gyroid = sin(dx) * cos(dy) + sin(dy) * cos(dz) + sin(dz) * cos(dx);
+    return abs(gyroid) - T(thickness);
+  }
+
+  string cacheKey() const override { return functionKey("gyroid", {cx, cy, cz, scale, thickness}); }
+
+  double evaluate(double x, double y, double z) const override { return field<double>(x, y, z); }
+
+  void evaluateBatchFloat(const float* xs, const float* ys, const float* zs, float* out, int n) const override {
+    for (int i = 0; i < n; ++i) out[i] = field<float>(xs[i], ys[i], zs[i]);
   }
 };
 
-// Función Metaball (blobs orgánicos con smooth blending)
+// Función Metaball (blobs orgánicos con smooth blending). Una rejilla uniforme
+// sobre las esferas de influencia (radio 2r) limita cada muestra a los blobs
+// cercanos, así el costo depende de la densidad local y no del total.
 class MetaballFunction : public ImplicitFunction {
 private:
   vector<Point> centers;
   vector<double> radii;
   double threshold;
-  
+
+  // Rejilla de aceleración en formato CSR: los blobs de la celda c son
+  // cellBlobs[cellStart[c] .. cellStart[c + 1]), en orden ascendente
+  Point gridOrigin;
+  double cellSize = 1.0;
+  int dims[3] = {0, 0, 0};
+  vector<uint32_t> cellStart;
+  vector<uint32_t> cellBlobs;
+
+  int cellCoord(double v, double origin, int axis) const {
+    return max(0, min(dims[axis] - 1, (int)floor((v - origin) / cellSize)));
+  }
+
+  bool insideGrid(double x, double y, double z) const {
+    return x >= gridOrigin.X() && y >= gridOrigin.Y() && z >= gridOrigin.Z() &&
+           x < gridOrigin.X() + dims[0] * cellSize &&
+           y < gridOrigin.Y() + dims[1] * cellSize &&
+           z < gridOrigin.Z() + dims[2] * cellSize;
+  }
+
+  size_t cellIndex(int i, int j, int k) const { return ((size_t)i * dims[1] + j) * dims[2] + k; }
+
+  void buildGrid() {
+    if (centers.empty()) return;
+
+    double lo[3] = {INFINITY, INFINITY, INFINITY};
+    double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    double influence = 0.0;
+    for (size_t b = 0; b < centers.size(); ++b) {
+      double c[3] = {centers[b].X(), centers[b].Y(), centers[b].Z()};
+      for (int a = 0; a < 3; ++a) {
+        lo[a] = min(lo[a], c[a] - 2.0 * radii[b]);
+        hi[a] = max(hi[a], c[a] + 2.0 * radii[b]);
+      }
+      influence += 4.0 * radii[b];
+    }
+
+    // Celdas del tamaño del diámetro de influencia medio, hasta 128 por eje
+    cellSize = max(influence / centers.size(), 1e-9);
+    for (int a = 0; a < 3; ++a) cellSize = max(cellSize, (hi[a] - lo[a]) / 128.0);
+    gridOrigin = Point(lo[0], lo[1], lo[2]);
+    for (int a = 0; a < 3; ++a) dims[a] = max(1, (int)ceil((hi[a] - lo[a]) / cellSize) + 1);
+
+    // Dos pasadas: contar por celda y luego llenar
+    size_t cells = (size_t)dims[0] * dims[1] * dims[2];
+    cellStart.assign(cells + 1, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+      vector<uint32_t> cursor;
+      if (pass == 1) {
+        for (size_t c = 0; c < cells; ++c) cellStart[c + 1] += cellStart[c];
+        cellBlobs.resize(cellStart[cells]);
+        cursor.assign(cellStart.begin(), cellStart.end() - 1);
+      }
+      for (size_t b = 0; b < centers.size(); ++b) {
+        double reach = 2.0 * radii[b];
+        int i0 = cellCoord(centers[b].X() - reach, gridOrigin.X(), 0), i1 = cellCoord(centers[b].X() + reach, gridOrigin.X(), 0);
+        int j0 = cellCoord(centers[b].Y() - reach, gridOrigin.Y(), 1), j1 = cellCoord(centers[b].Y() + reach, gridOrigin.Y(), 1);
+        int k0 = cellCoord(centers[b].Z() - reach, gridOrigin.Z(), 2), k1 = cellCoord(centers[b].Z() + reach, gridOrigin.Z(), 2);
+        for (int i = i0; i <= i1; ++i)
+          for (int j = j0; j <= j1; ++j)
+            for (int k = k0; k <= k1; ++k) {
+              size_t c = cellIndex(i, j, k);
+              if (pass == 0) cellStart[c + 1]++;
+              else cellBlobs[cursor[c]++] = (uint32_t)b;
+            }
+      }
+    }
+  }
+
+  // Blobs cuya influencia puede alcanzar la caja [lo, hi], ordenados
+  void candidates(const Point &lo, const Point &hi, vector<uint32_t> &out) const {
+    out.clear();
+    if (centers.empty()) return;
+    int i0 = cellCoord(lo.X(), gridOrigin.X(), 0), i1 = cellCoord(hi.X(), gridOrigin.X(), 0);
+    int j0 = cellCoord(lo.Y(), gridOrigin.Y(), 1), j1 = cellCoord(hi.Y(), gridOrigin.Y(), 1);
+    int k0 = cellCoord(lo.Z(), gridOrigin.Z(), 2), k1 = cellCoord(hi.Z(), gridOrigin.Z(), 2);
+    for (int i = i0; i <= i1; ++i)
+      for (int j = j0; j <= j1; ++j)
+        for (int k = k0; k <= k1; ++k) {
+          size_t c = cellIndex(i, j, k);
+          out.insert(out.end(), cellBlobs.begin() + cellStart[c], cellBlobs.begin() + cellStart[c + 1]);
+        }
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+  }
+
+  // Suma por lotes: blobs por fuera y puntos por dentro, en el mismo orden de
+  // blobs que evaluate para obtener exactamente los mismos valores
+  template <typename T>
+  void sampleBrickAs(const BrickRegion &brick, T* out) const {
+    size_t n = brick.points();
+    thread_local vector<uint32_t> blobs;
+    candidates(brick.minCorner(), brick.maxCorner(), blobs);
+
+    vector<T> xs(brick.nx), ys(brick.ny), zs(brick.nz), sum(n, T(0));
+    for (int i = 0; i < brick.nx; ++i) xs[i] = T((brick.i0 + i) * brick.spacing);
+    for (int j = 0; j < brick.ny; ++j) ys[j] = T((brick.j0 + j) * brick.spacing);
+    for (int k = 0; k < brick.nz; ++k) zs[k] = T((brick.k0 + k) * brick.spacing);
+
+    for (uint32_t b : blobs) {
+      T cx = T(centers[b].X()), cy = T(centers[b].Y()), cz = T(centers[b].Z());
+      T r_sq = T(radii[b]) * T(radii[b]);
+      T reach = r_sq * T(4.0);
+      T* s = sum.data();
+      for (int i = 0; i < brick.nx; ++i) {
+        T dx = xs[i] - cx;
+        for (int j = 0; j < brick.ny; ++j) {
+          T dy = ys[j] - cy;
+          T dxy = dx*dx + dy*dy;
+          for (int k = 0; k < brick.nz; ++k, ++s) {
+            T dz = zs[k] - cz;
+            T dist_sq = dxy + dz*dz;
+            *s += dist_sq < reach ? r_sq / (dist_sq + T(0.0001)) : T(0);
+          }
+        }
+      }
+    }
+
+    for (size_t p = 0; p < n; ++p) out[p] = T(threshold) - sum[p];
+  }
+
 public:
   MetaballFunction(const vector<Point>& centers, const vector<double>& radii, double threshold = 1.0)
-    : centers(centers), radii(radii), threshold(threshold) {}
+    : centers(centers), radii(radii), threshold(threshold) {
+    buildGrid();
+  }
   
+  string cacheKey() const override {
+    vector<double> params = {threshold};
+    for (size_t i = 0; i < centers.size(); ++i) {
+      params.insert(params.end(), {centers[i].X(), centers[i].Y(), centers[i].Z(), radii[i]});
+    }
+    return functionKey("metaballs", params);
+  }
+
   double evaluate(double x, double y, double z) const override {
     double sum = 0.0;
-    for (size_t i = 0; i < centers.size(); ++i) {
+    if (centers.empty() || !insideGrid(x, y, z)) return threshold - sum;
+
+    size_t c = cellIndex(cellCoord(x, gridOrigin.X(), 0), cellCoord(y, gridOrigin.Y(), 1), cellCoord(z, gridOrigin.Z(), 2));
+    for (uint32_t n = cellStart[c]; n < cellStart[c + 1]; ++n) {
+      uint32_t i = cellBlobs[n];
       double dx = x - centers[i].X();
       double dy = y - centers[i].Y();
       double dz = z - centers[i].Z();
@@ -480,6 +909,10 @@ public:
     }
     return threshold - sum;
   }
+
+  void sampleBrick(const BrickRegion &brick, double* out) const override { sampleBrickAs(brick, out); }
+
+  void sampleBrickFloat(const BrickRegion &brick, float* out) const override { sampleBrickAs(brick, out); }
 };
 
 // Función Mandelbulb simplificada (fractal 3D)
@@ -489,13 +922,215 @@ private:
   double power;
   int iterations;
   double bailout;
-  
+  int integerPower;     // power si es entero en [2, 64], 0 si no
+  double cullLevel = 0.0;
+
+  // Puntos por lote en el kernel polinomial
+  static const int LANES = 8;
+
+  // (c + i*s)^n por cuadrados sucesivos en todos los carriles: cos(n*a),
+  // sin(n*a) sin trigonometría. El recorrido de los bits de n queda afuera
+  // del bucle de carriles, que no tiene saltos.
+  static void complexPower(double* c, double* s, int n) {
+    double rc[LANES], rs[LANES];
+    for (int l = 0; l < LANES; ++l) {
+      rc[l] = 1.0;
+      rs[l] = 0.0;
+    }
+    for (; n > 0; n >>= 1) {
+      if (n & 1) {
+        for (int l = 0; l < LANES; ++l) {
+          double t = rc[l] * c[l] - rs[l] * s[l];
+          rs[l] = rc[l] * s[l] + rs[l] * c[l];
+          rc[l] = t;
+        }
+      }
+      for (int l = 0; l < LANES; ++l) {
+        double t = c[l] * c[l] - s[l] * s[l];
+        s[l] = 2.0 * c[l] * s[l];
+        c[l] = t;
+      }
+    }
+    for (int l = 0; l < LANES; ++l) {
+      c[l] = rc[l];
+      s[l] = rs[l];
+    }
+  }
+
+  // r^n en todos los carriles
+  static void integerPow(const double* r, double* out, int n) {
+    double base[LANES];
+    for (int l = 0; l < LANES; ++l) {
+      base[l] = r[l];
+      out[l] = 1.0;
+    }
+    for (; n > 0; n >>= 1) {
+      if (n & 1) {
+        for (int l = 0; l < LANES; ++l) out[l] *= base[l];
+      }
+      for (int l = 0; l < LANES; ++l) base[l] *= base[l];
+    }
+  }
+
+  // Forma polinomial para potencias enteras: el ángulo n*theta se obtiene
+  // elevando (cos theta + i sin theta) a la n, con cos y sin sacados de las
+  // coordenadas. Evalúa LANES puntos a la vez: todos los carriles hacen las
+  // mismas cuentas y los que ya escaparon conservan su estado por máscara.
+  // Los que caen en el eje (rho = 0) se recalculan con la forma
+  // trigonométrica.
+  void evaluateLanes(const double* xs, const double* ys, const double* zs, double* out, int n) const {
+    double dx[LANES], dy[LANES], dz[LANES];
+    double zx[LANES], zy[LANES], zz[LANES];
+    double dr[LANES], r[LANES];
+    double ct[LANES], st[LANES], cp[LANES], sp[LANES], rn1[LANES];
+    bool active[LANES], degenerate[LANES];
+
+    for (int l = 0; l < LANES; ++l) {
+      int p = min(l, n - 1);
+      dx[l] = xs[p] - cx;
+      dy[l] = ys[p] - cy;
+      dz[l] = zs[p] - cz;
+      zx[l] = dx[l];
+      zy[l] = dy[l];
+      zz[l] = dz[l];
+      dr[l] = 1.0;
+      r[l] = 0.0;
+      active[l] = l < n;
+      degenerate[l] = false;
+    }
+
+    for (int i = 0; i < iterations; i++) {
+      int live = 0;
+      for (int l = 0; l < LANES; ++l) {
+        double rho2 = zx[l]*zx[l] + zy[l]*zy[l];
+        double radius = sqrt(rho2 + zz[l]*zz[l]);
+        r[l] = active[l] ? radius : r[l];
+        bool escaped = radius > bailout;
+        degenerate[l] = degenerate[l] || (active[l] && !escaped && rho2 == 0.0);
+        active[l] = active[l] && !escaped && rho2 != 0.0;
+        live += active[l];
+
+        // En los carriles inactivos estas cuentas pueden dar NaN; se descartan
+        double rho = sqrt(rho2);
+        ct[l] = zz[l] / radius;
+        st[l] = rho / radius;
+        cp[l] = zx[l] / rho;
+        sp[l] = zy[l] / rho;
+      }
+      if (live == 0) break;
+
+      complexPower(ct, st, integerPower);
+      complexPower(cp, sp, integerPower);
+      integerPow(r, rn1, integerPower - 1);
+
+      for (int l = 0; l < LANES; ++l) {
+        double zr = rn1[l] * r[l];
+        dr[l] = active[l] ? rn1[l] * power * dr[l] + 1.0 : dr[l];
+        zx[l] = active[l] ? zr * st[l] * cp[l] + dx[l] : zx[l];
+        zy[l] = active[l] ? zr * st[l] * sp[l] + dy[l] : zy[l];
+        zz[l] = active[l] ? zr * ct[l] + dz[l] : zz[l];
+      }
+    }
+
+    for (int l = 0; l < n; ++l) {
+      out[l] = degenerate[l] ? evaluateTrigonometric(xs[l], ys[l], zs[l])
+                             : 0.5 * log(r[l]) * r[l] / dr[l] - 0.01;
+    }
+  }
+
+  template <typename T>
+  void sampleBrickAs(const BrickRegion &brick, T* out) const {
+    Point lo = brick.minCorner(), hi = brick.maxCorner();
+
+    // Fuera de la esfera de escape la iteración corta en el primer paso y el
+    // valor es 0.5 * log(r) * r - 0.01, el mismo que da evaluateLanes
+    double gap[3] = {max(max(lo.X() - cx, cx - hi.X()), 0.0),
+                     max(max(lo.Y() - cy, cy - hi.Y()), 0.0),
+                     max(max(lo.Z() - cz, cz - hi.Z()), 0.0)};
+    if (integerPower != 0 && sqrt(gap[0]*gap[0] + gap[1]*gap[1] + gap[2]*gap[2]) > bailout) {
+      sampleBrickRows(brick, out, [this](const T* xs, const T* ys, const T* zs, T* row, int n) {
+        for (int l = 0; l < n; ++l) {
+          double dx = double(xs[l]) - cx, dy = double(ys[l]) - cy, dz = double(zs[l]) - cz;
+          double r = sqrt((dx*dx + dy*dy) + dz*dz);
+          row[l] = T(0.5 * log(r) * r - 0.01);
+        }
+      });
+      return;
+    }
+
+    // La cota de distancia en el centro del bloque, menos su semidiagonal y
+    // una celda de margen, acota la función en todo el bloque y en las
+    // celdas vecinas; si supera cullLevel no hay superficie cerca. Solo vale
+    // dentro de la esfera de escape: afuera la función crece como r*log(r)
+    // y la cota de distancia deja de ser una cota.
+    Point center = (lo + hi) * 0.5;
+    Point half = (hi - lo) * 0.5;
+    double halfDiagonal = sqrt(half.X()*half.X() + half.Y()*half.Y() + half.Z()*half.Z());
+    Point offset = center - Point(cx, cy, cz);
+    bool inside = sqrt(offset.X()*offset.X() + offset.Y()*offset.Y() + offset.Z()*offset.Z()) <= bailout;
+    double bound = evaluate(center.X(), center.Y(), center.Z());
+
+    if (inside && bound - halfDiagonal - brick.spacing * sqrt(3.0) > cullLevel) {
+      for (int i = 0; i < brick.nx; ++i) {
+        for (int j = 0; j < brick.ny; ++j) {
+          for (int k = 0; k < brick.nz; ++k) {
+            Point d = Point((brick.i0 + i) * brick.spacing, (brick.j0 + j) * brick.spacing, (brick.k0 + k) * brick.spacing) - center;
+            *out++ = T(bound - sqrt(d.X()*d.X() + d.Y()*d.Y() + d.Z()*d.Z()));
+          }
+        }
+      }
+      return;
+    }
+
+    sampleBrickRows(brick, out, [this](const T* xs, const T* ys, const T* zs, T* row, int n) {
+      double x[LANES], y[LANES], z[LANES], v[LANES];
+      for (int start = 0; start < n; start += LANES) {
+        int count = min(LANES, n - start);
+        for (int l = 0; l < count; ++l) {
+          x[l] = xs[start + l];
+          y[l] = ys[start + l];
+          z[l] = zs[start + l];
+        }
+        evaluateBatch(x, y, z, v, count);
+        for (int l = 0; l < count; ++l) row[start + l] = T(v[l]);
+      }
+    });
+  }
+
 public:
   MandelbulbFunction(double cx, double cy, double cz, double power = 8.0, 
                      int iterations = 10, double bailout = 2.0)
-    : cx(cx), cy(cy), cz(cz), power(power), iterations(iterations), bailout(bailout) {}
-  
-  double evaluate(double x, double y, double z) const override {
+    : cx(cx), cy(cy), cz(cz), power(power), iterations(iterations), bailout(bailout) {
+    integerPower = (power == floor(power) && power >= 2.0 && power <= 64.0) ? (int)power : 0;
+  }
+
+  // Los bloques cuya cota no alcanza el nivel se rellenan con la cota en
+  // lugar de muestrearse
+  void setCullLevel(double level) override { cullLevel = level; }
+
+  // Sin cullLevel: el motor no poda los bloques que van a la caché
+  string cacheKey() const override { return functionKey("mandelbulb", {cx, cy, cz, power, (double)iterations, bailout}); }
+
+  // Punto a punto se usa la forma trigonométrica, que es la referencia del
+  // kernel polinomial de evaluateBatch
+  double evaluate(double x, double y, double z) const override { return evaluateTrigonometric(x, y, z); }
+
+  void evaluateBatch(const double* xs, const double* ys, const double* zs, double* out, int n) const override {
+    if (integerPower == 0) {
+      ImplicitFunction::evaluateBatch(xs, ys, zs, out, n);
+      return;
+    }
+    for (int start = 0; start < n; start += LANES) {
+      evaluateLanes(xs + start, ys + start, zs + start, out + start, min(LANES, n - start));
+    }
+  }
+
+  void sampleBrick(const BrickRegion &brick, double* out) const override { sampleBrickAs(brick, out); }
+
+  void sampleBrickFloat(const BrickRegion &brick, float* out) const override { sampleBrickAs(brick, out); }
+
+  // Forma original con coordenadas esféricas; sirve para potencias no enteras
+  double evaluateTrigonometric(double x, double y, double z) const {
     double dx = x - cx;
     double dy = y - cy;
     double dz = z - cz;
@@ -538,6 +1173,8 @@ public:
   HeartFunction(double cx, double cy, double cz, double scale = 1.0)
     : cx(cx), cy(cy), cz(cz), scale(scale) {}
   
+  string cacheKey() const override { return functionKey("heart", {cx, cy, cz, scale}); }
+
   double evaluate(double x, double y, double z) const override {
     // Normalizar coordenadas
     double dx = (x - cx) / scale;
@@ -586,6 +1223,8 @@ public:
   HeartFunctionSimple(double cx, double cy, double cz, double scale = 1.0)
     : cx(cx), cy(cy), cz(cz), scale(scale) {}
   
+  string cacheKey() const override { return functionKey("heart_simple", {cx, cy, cz, scale}); }
+
   double evaluate(double x, double y, double z) const override {
     double dx = (x - cx) / scale;
     double dy = (y - cy) / scale;
@@ -638,6 +1277,8 @@ public:
   ComplexHybridFunction(double cx, double cy, double cz, double time = 0.0)
     : cx(cx), cy(cy), cz(cz), time(time) {}
   
+  string cacheKey() const override { return functionKey("complex_hybrid", {cx, cy, cz, time}); }
+
   double evaluate(double x, double y, double z) const override {
     // Aplicar torsión al espacio
     Point twisted = twist(x - cx, y - cy, z - cz, 0.5);
@@ -703,58 +1344,682 @@ public:
   }
 };
 
-class MarchingCubes {
+// Lado en celdas de los bloques del índice de rangos
+const int SPAN_BLOCK = 8;
+
+// Árbol de intervalos centrado sobre los rangos [lo, hi) de los bloques de
+// celdas: stab(v) devuelve los bloques que tienen esquinas a ambos lados de v
+class SpanIndex {
+public:
+  struct Span {
+    double lo, hi;
+    int id;
+  };
+
+private:
+  struct Node {
+    double center;
+    vector<Span> byLo;  // Rangos que contienen center, por lo ascendente
+    vector<Span> byHi;  // Los mismos, por hi descendente
+    int left = -1, right = -1;
+  };
+
+  vector<Node> nodes;
+  int root = -1;
+
+  int build(vector<Span> spans) {
+    if (spans.empty()) return -1;
+    vector<double> ends;
+    for (const Span &s : spans) {
+      ends.push_back(s.lo);
+      ends.push_back(s.hi);
+    }
+    nth_element(ends.begin(), ends.begin() + ends.size() / 2, ends.end());
+    double center = ends[ends.size() / 2];
+
+    vector<Span> left, right, here;
+    for (const Span &s : spans) {
+      if (s.hi <= center) left.push_back(s);
+      else if (s.lo > center) right.push_back(s);
+      else here.push_back(s);
+    }
+    // Con extremos repetidos la mediana puede no separar nada
+    if (left.size() == spans.size() || right.size() == spans.size()) {
+      left.clear();
+      right.clear();
+      here = spans;
+    }
+
+    int id = (int)nodes.size();
+    nodes.push_back(Node());
+    nodes[id].center = center;
+    nodes[id].byLo = here;
+    sort(nodes[id].byLo.begin(), nodes[id].byLo.end(), [](const Span &a, const Span &b) { return a.lo < b.lo; });
+    nodes[id].byHi = here;
+    sort(nodes[id].byHi.begin(), nodes[id].byHi.end(), [](const Span &a, const Span &b) { return a.hi > b.hi; });
+    int l = build(move(left));
+    int r = build(move(right));
+    nodes[id].left = l;
+    nodes[id].right = r;
+    return id;
+  }
+
+public:
+  SpanIndex(const vector<Span> &spans) {
+    vector<Span> valid;
+    for (const Span &s : spans) {
+      if (s.lo < s.hi) valid.push_back(s);  // Bloques constantes nunca se cruzan
+    }
+    root = build(move(valid));
+  }
+
+  // Ids ordenados de los rangos con lo <= v < hi
+  vector<int> stab(double v) const {
+    vector<int> result;
+    for (int n = root; n >= 0;) {
+      const Node &node = nodes[n];
+      if (v < node.center) {
+        for (const Span &s : node.byLo) {
+          if (s.lo > v) break;
+          result.push_back(s.id);
+        }
+        n = node.left;
+      } else {
+        for (const Span &s : node.byHi) {
+          if (s.hi <= v) break;
+          result.push_back(s.id);
+        }
+        n = node.right;
+      }
+    }
+    sort(result.begin(), result.end());
+    return result;
+  }
+};
+
+// Desplazamiento de cada vértice del cubo en unidades de delta
+const int cornerOffset[8][3] = {
+    {0, 0, 0},
+    {1, 0, 0},
+    {1, 1, 0},
+    {0, 1, 0},
+    {0, 0, 1},
+    {1, 0, 1},
+    {1, 1, 1},
+    {0, 1, 1}};
+
+// Precisión del muestreo, de la interpolación y de la malla de muestras
+enum class Precision { Double, Float, Int16 };
+
+// Lado en puntos de los bloques en que se muestrea la rejilla
+const int LATTICE_BRICK = 16;
+
+// Codificación de los valores guardados en la malla de muestras. Real es el
+// tipo en el que se muestrea e interpola; brick es el bloque de
+// LATTICE_BRICK puntos al que pertenece el valor.
+template <typename S>
+struct ScalarCodec {
+  typedef S Real;
+  static const bool scaled = false;
+
+  void layout(size_t) {}
+  void setLevel(double) {}
+  void fit(size_t, double) {}
+  double scaleOf(size_t) const { return 0.0; }
+  void useScale(size_t, double) {}
+  S encode(Real v, size_t) const { return v; }
+  Real decode(S v, size_t) const { return v; }
+};
+
+// int16 cuantizado con una escala por bloque, relativa a un nivel. La escala
+// se ajusta a una banda alrededor de los iso-valores (ver quantizationBand) y
+// lo que queda afuera satura, así el campo puede ser enorme lejos de la
+// superficie sin quitarle resolución cerca. El signo de v - nivel se
+// conserva: la clasificación es exacta para el iso-valor igual al nivel y en
+// los demás el error es el de la cuantización.
+template <>
+struct ScalarCodec<int16_t> {
+  typedef float Real;
+  static const bool scaled = true;
+
+  float level = 0.0f;
+  vector<float> scales;
+  vector<float> inverses;
+
+  void layout(size_t bricks) {
+    scales.assign(bricks, 1.0f);
+    inverses.assign(bricks, 1.0f);
+  }
+
+  void setLevel(double value) { level = (float)value; }
+
+  // band es el mayor |v - nivel| que debe representarse sin saturar
+  void fit(size_t brick, double band) {
+    if (!(band > 0) || !isfinite(band)) band = 1.0;
+    useScale(brick, 32767.0 / band);
+  }
+
+  double scaleOf(size_t brick) const { return scales[brick]; }
+
+  void useScale(size_t brick, double value) {
+    scales[brick] = (float)value;
+    inverses[brick] = 1.0f / scales[brick];
+  }
+
+  int16_t encode(float v, size_t brick) const {
+    if (isnan(v)) return 0;  // NaN no es > nivel: se clasifica como interior
+    float d = v - level;
+    float q = max(-32767.0f, min(32767.0f, d * scales[brick]));
+    int16_t r = (int16_t)lrintf(q);
+    if (d > 0 && r <= 0) r = 1;  // Conservar el signo para la clasificación
+    return r;
+  }
+
+  float decode(int16_t q, size_t brick) const { return q * inverses[brick] + level; }
+};
+
+// Malla de valores muestreados en los vértices de la rejilla (z contiguo)
+template <typename S>
+class ScalarLattice {
+public:
+  int nx = 0, ny = 0, nz = 0;
+  int bricks[3] = {0, 0, 0};  // Bloques de LATTICE_BRICK puntos por eje
+  vector<S> values;
+  ScalarCodec<S> codec;
+
+  void resize(int nx, int ny, int nz) {
+    this->nx = nx;
+    this->ny = ny;
+    this->nz = nz;
+    bricks[0] = (nx + LATTICE_BRICK - 1) / LATTICE_BRICK;
+    bricks[1] = (ny + LATTICE_BRICK - 1) / LATTICE_BRICK;
+    bricks[2] = (nz + LATTICE_BRICK - 1) / LATTICE_BRICK;
+    values.resize((size_t)nx * ny * nz);
+    codec.layout((size_t)bricks[0] * bricks[1] * bricks[2]);
+  }
+
+  size_t index(int i, int j, int k) const { return ((size_t)i * ny + j) * nz + k; }
+
+  size_t brickOf(int i, int j, int k) const {
+    return ((size_t)(i / LATTICE_BRICK) * bricks[1] + j / LATTICE_BRICK) * bricks[2] + k / LATTICE_BRICK;
+  }
+
+  typename ScalarCodec<S>::Real at(int i, int j, int k) const {
+    return codec.decode(values[index(i, j, k)], brickOf(i, j, k));
+  }
+
+  size_t bytes() const { return values.size() * sizeof(S); }
+};
+
+
+template <typename S> const char* storageName();
+template <> inline const char* storageName<double>() { return "double"; }
+template <> inline const char* storageName<float>() { return "float"; }
+template <> inline const char* storageName<int16_t>() { return "int16"; }
+
+// Hash FNV-1a de 64 bits
+inline uint64_t fnv1a(const string &text, uint64_t hash = 1469598103934665603ull) {
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Compresión sin pérdida de un bloque: diferencia de cada valor con el
+// anterior, separación por planos de bytes y RLE de ceros. Los campos suaves dejan los
+// bytes altos casi siempre en cero.
+template <typename U>
+void compressBrick(const U* values, size_t n, vector<uint8_t> &out) {
+  const size_t width = sizeof(U);
+  vector<uint8_t> planes(n * width);
+  U previous = 0;
+  for (size_t i = 0; i < n; ++i) {
+    // Diferencia de los patrones de bits en zigzag: pequeña si el campo es suave
+    U diff = values[i] - previous;
+    U delta = (diff << 1) ^ (U)(0 - (diff >> (8 * width - 1)));
+    previous = values[i];
+    for (size_t b = 0; b < width; ++b) planes[b * n + i] = (uint8_t)(delta >> (8 * b));
+  }
+
+  // Byte de control c: c < 128 -> c + 1 literales; c >= 128 -> c - 127 ceros
+  out.clear();
+  size_t i = 0;
+  while (i < planes.size()) {
+    size_t zeros = 0;
+    while (i + zeros < planes.size() && planes[i + zeros] == 0 && zeros < 128) ++zeros;
+    if (zeros >= 2) {
+      out.push_back((uint8_t)(127 + zeros));
+      i += zeros;
+      continue;
+    }
+    size_t start = i, length = 0;
+    while (i < planes.size() && length < 128 &&
+           !(planes[i] == 0 && i + 1 < planes.size() && planes[i + 1] == 0)) {
+      ++i;
+      ++length;
+    }
+    out.push_back((uint8_t)(length - 1));
+    out.insert(out.end(), planes.begin() + start, planes.begin() + start + length);
+  }
+}
+
+template <typename U>
+bool decompressBrick(const uint8_t* data, size_t size, U* values, size_t n) {
+  const size_t width = sizeof(U);
+  vector<uint8_t> planes(n * width);
+  size_t o = 0;
+  for (size_t i = 0; i < size;) {
+    uint8_t c = data[i++];
+    if (c >= 128) {
+      size_t zeros = c - 127;
+      if (o + zeros > planes.size()) return false;
+      fill(planes.begin() + o, planes.begin() + o + zeros, 0);
+      o += zeros;
+    } else {
+      size_t length = c + 1;
+      if (o + length > planes.size() || i + length > size) return false;
+      memcpy(&planes[o], data + i, length);
+      o += length;
+      i += length;
+    }
+  }
+  if (o != planes.size()) return false;
+
+  U previous = 0;
+  for (size_t i = 0; i < n; ++i) {
+    U delta = 0;
+    for (size_t b = 0; b < width; ++b) delta |= (U)planes[b * n + i] << (8 * b);
+    U diff = (delta >> 1) ^ (U)(0 - (delta & 1));
+    previous += diff;
+    values[i] = previous;
+  }
+  return true;
+}
+
+template <size_t Width> struct BitsOf;
+template <> struct BitsOf<2> { typedef uint16_t type; };
+template <> struct BitsOf<4> { typedef uint32_t type; };
+template <> struct BitsOf<8> { typedef uint64_t type; };
+
+// Caché en disco de la rejilla muestreada, por bloques de LATTICE_BRICK^3
+// puntos. Los bloques comprimidos se agregan a <clave>.bricks, que se lee
+// con mmap, y el índice <clave>.idx dice dónde está cada bloque, de modo que
+// otra corrida con el mismo campo y paso reutiliza los bloques que necesite.
+// Admite un solo escritor por clave: dos procesos que agreguen bloques al
+// mismo archivo a la vez se pisan los desplazamientos y el último índice
+// escrito pierde los bloques del otro. Dentro del proceso, load y store se
+// pueden llamar desde varios hilos; el candado cubre solo el índice y el
+// archivo de datos, la (des)compresión corre afuera.
+class FieldCache {
 private:
+  struct Entry {
+    uint64_t offset;
+    uint32_t size;
+    double scale;  // Escala de int16 del bloque; 0 en los demás tipos
+  };
+
+  string dataPath;
+  string indexPath;
+  string header;
+  map<tuple<int, int, int>, Entry> entries;
+  uint64_t dataSize = 0;
+  bool dirty = false;
+
+  const uint8_t* mapped = nullptr;
+  size_t mappedSize = 0;
+  ofstream appender;
+  mutex lock;
+
+public:
+  atomic<size_t> hits{0};
+  atomic<size_t> misses{0};
+
+  FieldCache() {}
+  FieldCache(const FieldCache&) = delete;
+  FieldCache& operator=(const FieldCache&) = delete;
+  ~FieldCache() { close(); }
+
+  // Abre (o crea) la caché para la clave de la función, el paso y el tipo
+  // de almacenamiento
+  bool open(const string &directory, const string &functionKey, double spacing, const string &storage) {
+    close();
+    ostringstream key;
+    key << functionKey << " | spacing " << hexfloat << spacing << " | " << storage << " | brick " << LATTICE_BRICK;
+    // Dos hashes con semillas distintas para que un choque sea improbable
+    ostringstream name;
+    name << hex << setfill('0') << setw(16) << fnv1a(key.str()) << setw(16) << fnv1a(key.str(), 0x84222325cbf29ce4ull);
+    string base = directory + "/field-" + name.str();
+    dataPath = base + ".bricks";
+    indexPath = base + ".idx";
+    header = name.str();
+
+    ifstream index(indexPath);
+    string word, id;
+    if (index >> word >> id && word == "mcfield" && id == header) {
+      string tag;
+      while (index >> tag) {
+        if (tag == "b") {
+          int i, j, k;
+          string scale;
+          Entry entry;
+          index >> i >> j >> k >> entry.offset >> entry.size >> scale;
+          entry.scale = strtod(scale.c_str(), nullptr);
+          entries[make_tuple(i, j, k)] = entry;
+        }
+      }
+    }
+
+    int fd = ::open(dataPath.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          mapped = (const uint8_t*)data;
+          mappedSize = info.st_size;
+        }
+      }
+      ::close(fd);
+    }
+    dataSize = mappedSize;
+
+    // Descartar entradas que apunten fuera del archivo (índice de otra versión)
+    for (auto it = entries.begin(); it != entries.end();) {
+      if (!inMapping(it->second)) it = entries.erase(it);
+      else ++it;
+    }
+
+    appender.open(dataPath, ios::binary | ios::app);
+    return appender.good();
+  }
+
+  size_t size() const { return entries.size(); }
+
+  // Los bloques agregados en esta corrida quedan después de lo mapeado
+  bool inMapping(const Entry &entry) const {
+    return entry.offset <= mappedSize && entry.size <= mappedSize - entry.offset;
+  }
+
+  // Lee el bloque (bi, bj, bk), en unidades de bloque, y su escala
+  template <typename S>
+  bool load(int bi, int bj, int bk, S* values, double &scale) {
+    typedef typename BitsOf<sizeof(S)>::type U;
+    Entry entry;
+    {
+      lock_guard<mutex> guard(lock);
+      auto it = entries.find(make_tuple(bi, bj, bk));
+      if (it == entries.end() || mapped == nullptr || !inMapping(it->second)) {
+        ++misses;
+        return false;
+      }
+      entry = it->second;
+    }
+    // El mapeo es de solo lectura y no cambia hasta close
+    size_t n = (size_t)LATTICE_BRICK * LATTICE_BRICK * LATTICE_BRICK;
+    vector<U> bits(n);
+    if (!decompressBrick(mapped + entry.offset, entry.size, bits.data(), n)) {
+      ++misses;
+      return false;
+    }
+    memcpy(values, bits.data(), n * sizeof(S));
+    scale = entry.scale;
+    ++hits;
+    return true;
+  }
+
+  template <typename S>
+  void store(int bi, int bj, int bk, const S* values, double scale) {
+    typedef typename BitsOf<sizeof(S)>::type U;
+    size_t n = (size_t)LATTICE_BRICK * LATTICE_BRICK * LATTICE_BRICK;
+    vector<U> bits(n);
+    memcpy(bits.data(), values, n * sizeof(S));
+    vector<uint8_t> packed;
+    compressBrick(bits.data(), n, packed);
+
+    lock_guard<mutex> guard(lock);
+    appender.write((const char*)packed.data(), packed.size());
+    entries[make_tuple(bi, bj, bk)] = Entry{dataSize, (uint32_t)packed.size(), scale};
+    dataSize += packed.size();
+    dirty = true;
+  }
+
+  // Reescribe el índice con los bloques agregados en esta corrida. Se escribe
+  // en un temporal y se renombra para que un corte no deje un índice a medias.
+  bool flush() {
+    lock_guard<mutex> guard(lock);
+    if (!dirty) return true;
+    appender.flush();
+    string temporary = indexPath + ".tmp";
+    {
+      ofstream index(temporary, ios::trunc);
+      index << "mcfield " << header << "\n";
+      for (auto &entry : entries) {
+        index << "b " << get<0>(entry.first) << " " << get<1>(entry.first) << " " << get<2>(entry.first)
+              << " " << entry.second.offset << " " << entry.second.size
+              << " " << hexfloat << entry.second.scale << defaultfloat << "\n";
+      }
+      index.flush();
+      if (!index || !appender) {
+        index.close();
+        unlink(temporary.c_str());
+        return false;
+      }
+    }
+    if (rename(temporary.c_str(), indexPath.c_str()) != 0) {
+      unlink(temporary.c_str());
+      return false;
+    }
+    dirty = false;
+    return true;
+  }
+
+  void close() {
+    flush();
+    if (appender.is_open()) appender.close();
+    if (mapped) munmap((void*)mapped, mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+    entries.clear();
+    dataSize = 0;
+  }
+};
+
+inline void sampleBrick(const ImplicitFunction* func, const BrickRegion &brick, double* out) {
+  func->sampleBrick(brick, out);
+}
+
+inline void sampleBrick(const ImplicitFunction* func, const BrickRegion &brick, float* out) {
+  func->sampleBrickFloat(brick, out);
+}
+
+// Interpola el cruce por cero sobre la arista p0-p1 en la precisión Real
+template <typename Real>
+inline void interpolateEdge(const Real p0[3], const Real p1[3], Real v0, Real v1, Point &out) {
+  if (abs(v0) < Real(EPSILON)) { out = Point(p0[0], p0[1], p0[2]); return; }
+  if (abs(v1) < Real(EPSILON)) { out = Point(p1[0], p1[1], p1[2]); return; }
+
+  if (v0 * v1 > 0) {
+    out = Point((p0[0] + p1[0]) * Real(0.5), (p0[1] + p1[1]) * Real(0.5), (p0[2] + p1[2]) * Real(0.5));
+    return;
+  }
+
+  Real t = v0 / (v0 - v1);
+
+  t = max(Real(0), min(Real(1), t));
+
+  out = Point(p0[0] + (p1[0] - p0[0]) * t, p0[1] + (p1[1] - p0[1]) * t, p0[2] + (p1[2] - p0[2]) * t);
+}
+
+// Desviación máxima de los vértices de mesh respecto al vértice más cercano
+// de reference, buscando en una rejilla hash de lado cellSize
+inline double maxVertexDeviation(const MeshArena &reference, const MeshArena &mesh, double cellSize) {
+  auto key = [cellSize](double x, double y, double z, int dx, int dy, int dz) {
+    int64_t i = (int64_t)floor(x / cellSize) + dx;
+    int64_t j = (int64_t)floor(y / cellSize) + dy;
+    int64_t k = (int64_t)floor(z / cellSize) + dz;
+    return (i * 73856093) ^ (j * 19349663) ^ (k * 83492791);
+  };
+
+  unordered_map<int64_t, vector<Point>> grid;
+  for (const MeshPage* page = reference.pages(); page; page = page->next) {
+    for (int i = 0; i < page->vertexCount; ++i) {
+      const Point &p = page->vertices[i];
+      grid[key(p.X(), p.Y(), p.Z(), 0, 0, 0)].push_back(p);
+    }
+  }
+  if (grid.empty()) return mesh.vertices() == 0 ? 0.0 : INFINITY;
+
+  double worst = 0.0;
+  for (const MeshPage* page = mesh.pages(); page; page = page->next) {
+    for (int v = 0; v < page->vertexCount; ++v) {
+      const Point &p = page->vertices[v];
+      double bestSq = INFINITY;
+      // Anillos crecientes: todo punto fuera del anillo r está a más de r*cellSize
+      for (int ring = 0; ring < 64; ++ring) {
+        for (int dx = -ring; dx <= ring; ++dx) {
+          for (int dy = -ring; dy <= ring; ++dy) {
+            for (int dz = -ring; dz <= ring; ++dz) {
+              if (max(max(abs(dx), abs(dy)), abs(dz)) != ring) continue;
+              auto it = grid.find(key(p.X(), p.Y(), p.Z(), dx, dy, dz));
+              if (it == grid.end()) continue;
+              for (const Point &q : it->second) {
+                Point d = q - p;
+                bestSq = min(bestSq, d.X() * d.X() + d.Y() * d.Y() + d.Z() * d.Z());
+              }
+            }
+          }
+        }
+        if (sqrt(bestSq) <= ring * cellSize) break;
+      }
+      double best = sqrt(bestSq);
+      worst = max(worst, best);
+    }
+  }
+  return worst;
+}
+
+// Hash de la superficie que no depende del orden de los triángulos ni de
+// cómo se compartan los vértices: cada triángulo, con sus vértices en float,
+// se rota para empezar por el menor (sin cambiar la orientación) y la lista
+// se ordena antes de pasarla por fnv1a
+inline uint64_t meshHash(const MeshArena &mesh) {
+  typedef array<float, 9> Triangle;
   vector<Triangle> triangles;
-  int domain;
-  int delta;
+  triangles.reserve(mesh.triangles());
+  vector<const MeshPage*> pages;
+  for (const MeshPage* page = mesh.pages(); page; page = page->next) pages.push_back(page);
+
+  size_t page = 0, base = 0;
+  mesh.forEachTriangle([&](size_t a, size_t b, size_t c) {
+    while (a >= base + pages[page]->vertexCount) base += pages[page++]->vertexCount;
+    const Point* corner[3] = {&pages[page]->vertices[a - base], &pages[page]->vertices[b - base],
+                              &pages[page]->vertices[c - base]};
+    array<float, 3> v[3];
+    for (int n = 0; n < 3; ++n) {
+      v[n] = {(float)corner[n]->X() + 0.0f, (float)corner[n]->Y() + 0.0f, (float)corner[n]->Z() + 0.0f};
+    }
+    int first = (int)(min_element(v, v + 3) - v);
+    Triangle t;
+    for (int n = 0; n < 3; ++n) copy(v[(first + n) % 3].begin(), v[(first + n) % 3].end(), t.begin() + 3 * n);
+    triangles.push_back(t);
+  });
+  sort(triangles.begin(), triangles.end());
+
+  string bytes((const char*)triangles.data(), triangles.size() * sizeof(Triangle));
+  return fnv1a(bytes);
+}
+
+// Reparte count tareas entre threads hilos; cada hilo toma la siguiente libre
+template <typename F>
+inline void parallelFor(int count, int threads, F&& task) {
+  if (threads <= 1 || count <= 1) {
+    for (int t = 0; t < count; ++t) task(t);
+    return;
+  }
+  atomic<int> next(0);
+  vector<thread> workers;
+  for (int w = 0; w < min(threads, count); ++w) {
+    workers.emplace_back([&]() {
+      for (int t; (t = next++) < count;) task(t);
+    });
+  }
+  for (thread &worker : workers) worker.join();
+}
+
+class MarchingCubes {
+private:
+  MeshArena mesh;
+  int divisions[3];  // Celdas por eje
+  double delta;      // Separación entre muestras
   string filename;
   ImplicitFunction* func;
+  double isoValue = 0.0;
+  string cacheDirectory;
+  int threads = 1;
+  double elapsed = 0.0;
+
+  // Reparte [0, count) en tramos contiguos, cada uno con su propia malla, y
+  // los une en orden: el resultado no depende de la cantidad de hilos
+  template <typename F>
+  void meshInChunks(MeshArena &target, int count, F&& march) {
+    int chunks = min(count, threads <= 1 ? 1 : threads * 4);
+    vector<MeshArena> parts(max(chunks, 0));
+    parallelFor(chunks, threads, [&](int c) {
+      march(parts[c], (int)((long long)count * c / chunks), (int)((long long)count * (c + 1) / chunks));
+    });
+    for (MeshArena &part : parts) target.splice(part);
+  }
 
 public:
   MarchingCubes() {}
   MarchingCubes(int domain, int delta, const string &filename, ImplicitFunction* func)
-      : domain(domain), delta(delta), filename(filename), func(func) {}
-
-  void exportPly() {
-    fstream plyfile(this->filename, ios::out);
-    plyfile << "ply\n";
-    plyfile << "format ascii 1.0\n";
-    plyfile << "element vertex " << this->triangles.size() * 3 << "\n";
-    plyfile << "property float x" << "\n";
-    plyfile << "property float y" << "\n";
-    plyfile << "property float z" << "\n";
-    plyfile << "element face " << this->triangles.size() << "\n";
-    plyfile << "property list uchar int vertex_indices" << "\n";
-    plyfile << "end_header" << "\n";
+      : delta(delta), filename(filename), func(func) {
+    divisions[0] = divisions[1] = divisions[2] = domain / delta;
+  }
 
-    for (auto &triangle : triangles) {
-      triangle.getPly(plyfile);
+  // Dominio [0, extent.X()] x [0, extent.Y()] x [0, extent.Z()] con una
+  // separación que no necesita ser entera
+  MarchingCubes(const Point &extent, double delta, const string &filename, ImplicitFunction* func)
+      : delta(delta), filename(filename), func(func) {
+    const double size[3] = {extent.X(), extent.Y(), extent.Z()};
+    for (int a = 0; a < 3; ++a) {
+      double cells = cellsAlong(size[a], delta);
+      divisions[a] = cells > 0 ? (int)min(cells, (double)MAX_DIVISIONS) : 0;
     }
+  }
 
-    for (int i = 0; i < this->triangles.size(); i++) {
-      plyfile << "3 " << i * 3 << " " << i * 3 + 1 << " " << i * 3 + 2 << "\n";
-    }
+  // Mayor cantidad de celdas por eje: la rejilla tiene una muestra más y
+  // sus índices son int
+  static const int MAX_DIVISIONS = 2147483646;
 
-    plyfile.close();
-  }
+  // Celdas que entran en size con separación delta, sin truncar a int para
+  // que quien llama pueda comparar con MAX_DIVISIONS
+  static double cellsAlong(double size, double delta) { return floor(size / delta + 1e-9); }
 
-  int generateCase(double x, double y, double z, double delta) {
-    int whichCase = 0;
+  const MeshArena& getMesh() const { return mesh; }
 
-    double vertices[8][3] = {
-      {x, y, z}, 
-      {x + delta, y, z}, 
-      {x + delta, y + delta, z}, 
-      {x, y + delta, z}, 
-      {x, y, z + delta}, 
-      {x + delta, y, z + delta}, 
-      {x + delta, y + delta, z + delta}, 
-      {x, y + delta, z + delta}
-    };
+  // Segundos que tomó la última generación
+  double elapsedSeconds() const { return elapsed; }
+
+  // Hilos para generateMeshParallel, generateMeshCached y generateMeshes
+  void setThreads(int count) { threads = max(1, count); }
+
+  // Nivel de la superficie extraída: func(x, y, z) = isoValue
+  void setIsoValue(double iso) { isoValue = iso; }
+
+  // Guarda y reutiliza la rejilla muestreada en este directorio (solo en
+  // generateMeshCached y para funciones con cacheKey)
+  void setFieldCache(const string &directory) { cacheDirectory = directory; }
+
+  int generateCase(double x, double y, double z, double delta, double values[8]) const {
+    int whichCase = 0;
 
     for (int i = 0; i < 8; ++i) {
-      if (this->func->evaluate(vertices[i][0], vertices[i][1], vertices[i][2]) > 0) {
+      values[i] = this->func->evaluate(x + cornerOffset[i][0] * delta,
+                                       y + cornerOffset[i][1] * delta,
+                                       z + cornerOffset[i][2] * delta) - isoValue;
+      if (values[i] > 0) {
         whichCase |= (1 << i);
       }
     }
@@ -762,61 +2027,363 @@ public:
     return whichCase;
   }
 
-  Point findIntersection(Point p0, Point p1) {
-    double v0 = this->func->evaluate(p0.X(), p0.Y(), p0.Z());
-    double v1 = this->func->evaluate(p1.X(), p1.Y(), p1.Z());
-    
-    if (abs(v0) < EPSILON) return p0;
-    if (abs(v1) < EPSILON) return p1;
+  int generateCase(double x, double y, double z, double delta) {
+    double values[8];
+    return generateCase(x, y, z, delta, values);
+  }
 
-    if (v0 * v1 > 0) return (p0 + p1) * 0.5;
+  void findIntersection(const Point &p0, const Point &p1, double v0, double v1, Point &out) const {
+    const double a[3] = {p0.X(), p0.Y(), p0.Z()};
+    const double b[3] = {p1.X(), p1.Y(), p1.Z()};
+    interpolateEdge(a, b, v0, v1, out);
+  }
 
-    double t = v0 / (v0 - v1);
-    
-    t = max(0.0, min(1.0, t));
+  Point findIntersection(const Point &p0, const Point &p1) {
+    double v0 = this->func->evaluate(p0.X(), p0.Y(), p0.Z()) - isoValue;
+    double v1 = this->func->evaluate(p1.X(), p1.Y(), p1.Z()) - isoValue;
+    Point out;
+    findIntersection(p0, p1, v0, v1, out);
+    return out;
+  }
 
-    return p0 + (p1 - p0) * t;
+  // Escribe los triángulos del cubo directamente en la página actual de la
+  // malla; cada arista se interpola una sola vez y se comparte por índice.
+  template <typename Real>
+  static void emitCell(MeshArena &mesh, Real x, Real y, Real z, Real delta, const Real values[8], int whichCase) {
+    MeshPage* page = mesh.reserveCell();
+    Point* vertices = page->vertices + page->vertexCount;
+    uint16_t* indices = page->indices + page->indexCount;
+
+    int edgeSlot[12] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+    int newVertices = 0;
+    int newIndices = 0;
+
+    for (int i = 0; triTable[whichCase][i] != -1; ++i) {
+      int edge = triTable[whichCase][i];
+      if (edgeSlot[edge] < 0) {
+        int v0 = edge_vertice_mapper[edge].first;
+        int v1 = edge_vertice_mapper[edge].second;
+        const Real p0[3] = {x + cornerOffset[v0][0] * delta, y + cornerOffset[v0][1] * delta, z + cornerOffset[v0][2] * delta};
+        const Real p1[3] = {x + cornerOffset[v1][0] * delta, y + cornerOffset[v1][1] * delta, z + cornerOffset[v1][2] * delta};
+        interpolateEdge(p0, p1, values[v0], values[v1], vertices[newVertices]);
+        edgeSlot[edge] = page->vertexCount + newVertices++;
+      }
+      indices[newIndices++] = edgeSlot[edge];
+    }
+
+    mesh.commitCell(newVertices, newIndices);
   }
 
-  void generatePoints(double x, double y, double z, double delta) {
-    int whichCase = generateCase(x, y, z, delta);
+  void generatePoints(double x, double y, double z, double delta) { generatePoints(mesh, x, y, z, delta); }
+
+  void generatePoints(MeshArena &target, double x, double y, double z, double delta) {
+    double values[8];
+    int whichCase = generateCase(x, y, z, delta, values);
     if (whichCase == 0 || whichCase == 255) return;
 
-    Point cubeVertices[8] = {
-      Point(x, y, z),
-      Point(x + delta, y, z),
-      Point(x + delta, y + delta, z),
-      Point(x, y + delta, z),
-      Point(x, y, z + delta),
-      Point(x + delta, y, z + delta),
-      Point(x + delta, y + delta, z + delta),
-      Point(x, y + delta, z + delta)
+    emitCell(target, x, y, z, delta, values, whichCase);
+  }
+
+  // Muestrea la función una sola vez en todos los vértices de la rejilla,
+  // bloque a bloque, para extraer después los iso-valores de levels
+  template <typename S>
+  void sampleLattice(ScalarLattice<S> &lattice, const vector<double> &levels) {
+    typedef typename ScalarCodec<S>::Real Real;
+    lattice.resize(divisions[0] + 1, divisions[1] + 1, divisions[2] + 1);
+
+    // Con varios iso-valores el nivel exacto de int16 queda en el medio
+    LevelRange range = {0.0, 0.0, 0.0};
+    if (!levels.empty()) {
+      range.lowest = *min_element(levels.begin(), levels.end());
+      range.highest = *max_element(levels.begin(), levels.end());
+      range.level = 0.5 * (range.lowest + range.highest);
+    }
+    double level = range.level;
+    lattice.codec.setLevel(level);
+
+    FieldCache cache;
+    ostringstream storage;
+    storage << storageName<S>();
+    // Las escalas de int16 dependen de todo el rango de iso-valores, no solo
+    // del nivel: un bloque ajustado a otro rango saturaría
+    if (ScalarCodec<S>::scaled) storage << " isos " << hexfloat << range.lowest << " " << range.highest;
+    bool cached = false;
+    if (!cacheDirectory.empty()) {
+      if (func->cacheKey().empty()) {
+        cerr << "Field cache: this function cannot be cached; sampling without the cache.\n";
+      } else if (!(cached = cache.open(cacheDirectory, func->cacheKey(), delta, storage.str()))) {
+        cerr << "Field cache: could not open the cache in " << cacheDirectory << "; sampling without it.\n";
+      }
+    }
+
+    // Los bloques de la caché guardan muestras reales, así sirven para
+    // cualquier iso-valor; sin caché se poda hasta el mayor pedido
+    func->setCullLevel(cached ? INFINITY : range.highest);
+    if (cached) {
+      sampleLatticeCached(lattice, cache, range);
+      return;
+    }
+
+    // Los bloques particionan los puntos; cada uno se muestrea de una vez
+    vector<BrickRegion> bricks = latticeBricks(lattice, false);
+    parallelFor((int)bricks.size(), threads, [&](int b) {
+      const BrickRegion &brick = bricks[b];
+      vector<Real> values(brick.points());
+      sampleBrick(func, brick, values.data());
+      size_t id = lattice.brickOf(brick.i0, brick.j0, brick.k0);
+      if (ScalarCodec<S>::scaled) lattice.codec.fit(id, quantizationBand(values.data(), brick, range));
+
+      const Real* in = values.data();
+      for (int i = 0; i < brick.nx; ++i) {
+        for (int j = 0; j < brick.ny; ++j) {
+          S* out = &lattice.values[lattice.index(brick.i0 + i, brick.j0 + j, brick.k0)];
+          for (int k = 0; k < brick.nz; ++k) out[k] = lattice.codec.encode(*in++, id);
+        }
+      }
+    });
+  }
+
+  // Bloques de LATTICE_BRICK puntos que cubren la rejilla; los del borde se
+  // recortan salvo que full pida bloques completos
+  template <typename S>
+  vector<BrickRegion> latticeBricks(const ScalarLattice<S> &lattice, bool full) const {
+    vector<BrickRegion> bricks;
+    for (int bi = 0; bi < lattice.nx; bi += LATTICE_BRICK) {
+      for (int bj = 0; bj < lattice.ny; bj += LATTICE_BRICK) {
+        for (int bk = 0; bk < lattice.nz; bk += LATTICE_BRICK) {
+          bricks.push_back({bi, bj, bk,
+                            full ? LATTICE_BRICK : min(LATTICE_BRICK, lattice.nx - bi),
+                            full ? LATTICE_BRICK : min(LATTICE_BRICK, lattice.ny - bj),
+                            full ? LATTICE_BRICK : min(LATTICE_BRICK, lattice.nz - bk),
+                            delta});
+        }
+      }
+    }
+    return bricks;
+  }
+
+  // Iso-valores pedidos y el nivel exacto de int16
+  struct LevelRange {
+    double lowest, highest, level;
+  };
+
+  // Banda de |v - nivel| que la cuantización del bloque debe representar: el
+  // mayor extremo de las aristas del bloque que cruzan algún iso-valor, con
+  // margen para las aristas que salen hacia los bloques vecinos. Si ninguna
+  // cruza adentro, solo importan los puntos de las caras.
+  template <typename Real>
+  static double quantizationBand(const Real* values, const BrickRegion &brick, const LevelRange &range) {
+    double band = 0.0;
+    bool crossing = false;
+    auto edge = [&](Real a, Real b) {
+      if (!isfinite(a) || !isfinite(b)) return;
+      if (min(a, b) <= range.highest && max(a, b) > range.lowest) {
+        band = max(band, max(abs(a - range.level), abs(b - range.level)));
+        crossing = true;
+      }
     };
+    size_t sj = brick.nz, si = (size_t)brick.ny * brick.nz;
+    for (int i = 0; i < brick.nx; ++i) {
+      for (int j = 0; j < brick.ny; ++j) {
+        for (int k = 0; k < brick.nz; ++k) {
+          size_t n = i * si + j * sj + k;
+          if (k + 1 < brick.nz) edge(values[n], values[n + 1]);
+          if (j + 1 < brick.ny) edge(values[n], values[n + sj]);
+          if (i + 1 < brick.nx) edge(values[n], values[n + si]);
+        }
+      }
+    }
+    if (crossing) return 4.0 * band;
 
-    Point edgeIntersections[12];
-    for (int i = 0; i < 12; ++i) {
-      int v0 = edge_vertice_mapper[i].first;
-      int v1 = edge_vertice_mapper[i].second;
-      edgeIntersections[i] = findIntersection(cubeVertices[v0], cubeVertices[v1]);
+    for (int i = 0; i < brick.nx; ++i) {
+      for (int j = 0; j < brick.ny; ++j) {
+        for (int k = 0; k < brick.nz; ++k) {
+          bool face = i == 0 || j == 0 || k == 0 || i == brick.nx - 1 || j == brick.ny - 1 || k == brick.nz - 1;
+          Real v = values[i * si + j * sj + k];
+          if (face && isfinite(v)) band = max(band, abs(v - range.level));
+        }
+      }
     }
+    return band;
+  }
+
+  // Como sampleLattice, pero con bloques completos que se leen de la caché en
+  // disco si ya existen y si no se muestrean y se agregan a ella
+  template <typename S>
+  void sampleLatticeCached(ScalarLattice<S> &lattice, FieldCache &cache, const LevelRange &range) {
+    typedef typename ScalarCodec<S>::Real Real;
+    size_t brickPoints = (size_t)LATTICE_BRICK * LATTICE_BRICK * LATTICE_BRICK;
+    vector<BrickRegion> bricks = latticeBricks(lattice, true);
 
-    for (int i = 0; triTable[whichCase][i] != -1; i += 3) {
-      Point p1 = edgeIntersections[triTable[whichCase][i]];
-      Point p2 = edgeIntersections[triTable[whichCase][i + 1]];
-      Point p3 = edgeIntersections[triTable[whichCase][i + 2]];
-      triangles.emplace_back(p1, p2, p3);
+    parallelFor((int)bricks.size(), threads, [&](int b) {
+      const BrickRegion &brick = bricks[b];
+      int ci = brick.i0 / LATTICE_BRICK, cj = brick.j0 / LATTICE_BRICK, ck = brick.k0 / LATTICE_BRICK;
+      size_t id = lattice.brickOf(brick.i0, brick.j0, brick.k0);
+      vector<S> encoded(brickPoints);
+      double scale = 0.0;
+      if (cache.load(ci, cj, ck, encoded.data(), scale)) {
+        if (ScalarCodec<S>::scaled) lattice.codec.useScale(id, scale);
+      } else {
+        vector<Real> values(brickPoints);
+        sampleBrick(func, brick, values.data());
+        if (ScalarCodec<S>::scaled) lattice.codec.fit(id, quantizationBand(values.data(), brick, range));
+        for (size_t n = 0; n < brickPoints; ++n) encoded[n] = lattice.codec.encode(values[n], id);
+        cache.store(ci, cj, ck, encoded.data(), lattice.codec.scaleOf(id));
+      }
+
+      int nx = min(LATTICE_BRICK, lattice.nx - brick.i0);
+      int ny = min(LATTICE_BRICK, lattice.ny - brick.j0);
+      int nz = min(LATTICE_BRICK, lattice.nz - brick.k0);
+      for (int i = 0; i < nx; ++i) {
+        for (int j = 0; j < ny; ++j) {
+          const S* in = &encoded[((size_t)i * LATTICE_BRICK + j) * LATTICE_BRICK];
+          copy(in, in + nz, &lattice.values[lattice.index(brick.i0 + i, brick.j0 + j, brick.k0)]);
+        }
+      }
+    });
+
+    cout << "Field cache: " << cache.hits << " bricks reused, " << cache.misses << " sampled.\n";
+    if (!cache.flush()) cerr << "Field cache: could not write the index in " << cacheDirectory << "\n";
+  }
+
+  // Recorre las celdas leyendo los valores de la rejilla muestreada
+  template <typename S>
+  void marchLattice(const ScalarLattice<S> &lattice) {
+    meshInChunks(mesh, lattice.nx - 1, [&](MeshArena &part, int i0, int i1) {
+      marchCells(part, lattice, i0, i1, 0, lattice.ny - 1, 0, lattice.nz - 1);
+    });
+  }
+
+  // Recorre las celdas [i0, i1) x [j0, j1) x [k0, k1)
+  template <typename S>
+  void marchCells(MeshArena &target, const ScalarLattice<S> &lattice, int i0, int i1, int j0, int j1, int k0, int k1) const {
+    typedef typename ScalarCodec<S>::Real Real;
+
+    for (int i = i0; i < i1; ++i) {
+      for (int j = j0; j < j1; ++j) {
+        for (int k = k0; k < k1; ++k) {
+          Real values[8];
+          int whichCase = 0;
+          for (int c = 0; c < 8; ++c) {
+            values[c] = lattice.at(i + cornerOffset[c][0], j + cornerOffset[c][1], k + cornerOffset[c][2]) - Real(isoValue);
+            if (values[c] > 0) whichCase |= (1 << c);
+          }
+          if (whichCase == 0 || whichCase == 255) continue;
+          emitCell(target, Real(i * delta), Real(j * delta), Real(k * delta), Real(delta), values, whichCase);
+        }
+      }
     }
   }
 
+  // Muestrea la rejilla una vez y extrae una malla por iso-valor. Solo se
+  // recorren los bloques de celdas cuyo rango [min, max) contiene el iso-valor.
+  template <typename S>
+  vector<MeshArena> generateMeshesAs(const vector<double> &isoValues) {
+    ScalarLattice<S> lattice;
+    sampleLattice(lattice, isoValues);
+
+    const int cells[3] = {lattice.nx - 1, lattice.ny - 1, lattice.nz - 1};
+    vector<array<int, 3>> blocks;
+    vector<SpanIndex::Span> spans;
+    for (int bi = 0; bi < cells[0]; bi += SPAN_BLOCK) {
+      for (int bj = 0; bj < cells[1]; bj += SPAN_BLOCK) {
+        for (int bk = 0; bk < cells[2]; bk += SPAN_BLOCK) {
+          double lo = INFINITY, hi = -INFINITY;
+          for (int i = bi; i <= min(bi + SPAN_BLOCK, cells[0]); ++i) {
+            for (int j = bj; j <= min(bj + SPAN_BLOCK, cells[1]); ++j) {
+              for (int k = bk; k <= min(bk + SPAN_BLOCK, cells[2]); ++k) {
+                double v = lattice.at(i, j, k);
+                if (isnan(v)) lo = -INFINITY;  // NaN nunca es > iso
+                lo = min(lo, v);
+                hi = max(hi, v);
+              }
+            }
+          }
+          spans.push_back({lo, hi, (int)blocks.size()});
+          blocks.push_back({bi, bj, bk});
+        }
+      }
+    }
+    SpanIndex index(spans);
+
+    double savedIso = isoValue;
+    vector<MeshArena> meshes;
+    for (double iso : isoValues) {
+      isoValue = iso;
+      mesh.clear();
+      vector<int> active = index.stab(iso);
+      meshInChunks(mesh, (int)active.size(), [&](MeshArena &part, int first, int last) {
+        for (int n = first; n < last; ++n) {
+          const array<int, 3> &b = blocks[active[n]];
+          marchCells(part, lattice,
+                     b[0], min(b[0] + SPAN_BLOCK, cells[0]),
+                     b[1], min(b[1] + SPAN_BLOCK, cells[1]),
+                     b[2], min(b[2] + SPAN_BLOCK, cells[2]));
+        }
+      });
+      cout << "Iso " << iso << ": " << mesh.triangles() << " triangles from "
+           << active.size() << " of " << blocks.size() << " blocks.\n";
+      meshes.push_back(move(mesh));
+    }
+    isoValue = savedIso;
+    return meshes;
+  }
+
+  // Varias iso-superficies anidadas de un solo muestreo
+  vector<MeshArena> generateMeshes(const vector<double> &isoValues, Precision precision = Precision::Double) {
+
+    auto start = chrono::high_resolution_clock::now();
+
+    vector<MeshArena> meshes;
+    switch (precision) {
+      case Precision::Double: meshes = generateMeshesAs<double>(isoValues); break;
+      case Precision::Float: meshes = generateMeshesAs<float>(isoValues); break;
+      case Precision::Int16: meshes = generateMeshesAs<int16_t>(isoValues); break;
+    }
+
+    auto end = chrono::high_resolution_clock::now();
+    elapsed = chrono::duration<double>(end - start).count();
+
+    cout << "Generated " << meshes.size() << " meshes in " << elapsed << " seconds.\n";
+    return meshes;
+  }
+
+  template <typename S>
+  void generateMeshCachedAs() {
+    ScalarLattice<S> lattice;
+    sampleLattice(lattice, {isoValue});
+    marchLattice(lattice);
+  }
+
+  // Variante que muestrea la rejilla una vez y luego interpola desde ella en
+  // la precisión pedida
+  void generateMeshCached(Precision precision = Precision::Double) {
+
+    auto start = chrono::high_resolution_clock::now();
+
+    mesh.clear();
+
+    switch (precision) {
+      case Precision::Double: generateMeshCachedAs<double>(); break;
+      case Precision::Float: generateMeshCachedAs<float>(); break;
+      case Precision::Int16: generateMeshCachedAs<int16_t>(); break;
+    }
+
+    auto end = chrono::high_resolution_clock::now();
+    elapsed = chrono::duration<double>(end - start).count();
+
+    cout << "Mesh generated with " << mesh.triangles() << " triangles in " << elapsed << " seconds.\n";
+  }
+
   void generateMesh() {
 
     auto start = chrono::high_resolution_clock::now();
 
-    int divisions = domain / delta;
+    mesh.clear();
 
-    for (int i = 0; i < divisions; ++i) {
-      for (int j = 0; j < divisions; ++j) {
-        for (int k = 0; k < divisions; ++k) {
+    for (int i = 0; i < divisions[0]; ++i) {
+      for (int j = 0; j < divisions[1]; ++j) {
+        for (int k = 0; k < divisions[2]; ++k) {
           double x = i * delta;
           double y = j * delta;
           double z = k * delta;
@@ -826,9 +2393,31 @@ public:
     }
 
     auto end = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed = end - start;
+    elapsed = chrono::duration<double>(end - start).count();
 
-    cout << "Mesh generated with " << triangles.size() << " triangles in " << elapsed.count() << " seconds.\n";
+    cout << "Mesh generated with " << mesh.triangles() << " triangles in " << elapsed << " seconds.\n";
   }
-};
 
+  // Mismo recorrido que generateMesh, repartido por capas de x entre hilos
+  void generateMeshParallel() {
+
+    auto start = chrono::high_resolution_clock::now();
+
+    mesh.clear();
+
+    meshInChunks(mesh, divisions[0], [&](MeshArena &part, int i0, int i1) {
+      for (int i = i0; i < i1; ++i) {
+        for (int j = 0; j < divisions[1]; ++j) {
+          for (int k = 0; k < divisions[2]; ++k) {
+            generatePoints(part, i * delta, j * delta, k * delta, delta);
+          }
+        }
+      }
+    });
+
+    auto end = chrono::high_resolution_clock::now();
+    elapsed = chrono::duration<double>(end - start).count();
+
+    cout << "Mesh generated with " << mesh.triangles() << " triangles in " << elapsed << " seconds.\n";
+  }
+};
@@ -0,0 +1,335 @@
+#include "csg.h"
+
+#include <dirent.h>
+#include <memory>
+#include <set>
+
+// Compara cada motor contra la referencia (MarchingCubes::generateMesh) para
+// todas las funciones y, opcionalmente, su rendimiento contra una línea base.
+//
+// Uso: validate [domain] [delta] [opciones]
+//   --threads n            hilos de los motores paralelos        (todos)
+//   --repeat n             corridas por motor; se toma la mejor  (3)
+//   --tol t                desviación máxima de los motores en double,
+//                          en unidades de delta                  (1e-6)
+//   --float-tol t          ídem para float                       (0.05)
+//   --int16-tol t          ídem para int16                       (0.25)
+//   --tris-tol p           diferencia de triángulos admitida en float e
+//                          int16, en porcentaje                  (1)
+//   --baseline archivo     compara el rendimiento contra el archivo
+//   --write-baseline archivo  guarda el rendimiento medido
+//   --max-regression p     caída de rendimiento admitida, en %   (20)
+//
+// La línea base no se versiona porque depende de la máquina: se crea con
+//   validate 512 8 --write-baseline base.txt
+// sobre el árbol de referencia y después se compara con
+//   validate 512 8 --baseline base.txt
+//
+// Motores: parallel (generateMeshParallel), batch (muestreo por bloques con
+// las evaluaciones por lotes), cached (batch servido desde el caché en disco
+// en la segunda corrida), adaptive (generateMeshes con el índice de rangos),
+// float e int16 (generateMeshCached en esas precisiones).
+//
+// Para cada uno se comparan la cantidad de triángulos, el hash de meshHash y
+// la distancia de Hausdorff entre los vértices de ambas mallas. Los motores
+// en double hacen las mismas cuentas que la referencia y deben dar el mismo
+// hash. Las combinaciones de expectedFailures fallan a sabiendas y se
+// informan como xfail; si pasan se informan como xpass y cuentan como falla,
+// para que la lista no quede vieja. Al final genera varios frames seguidos
+// con generateMeshParallel y falla si las páginas de malla o la memoria
+// residente crecen de un frame a otro. Devuelve 1 si algo falla.
+
+struct NamedFunction {
+  string name;
+  unique_ptr<ImplicitFunction> func;
+  double extent;  // Lado del cubo muestreado; 0 para usar domain
+  double iso;
+  // Los motores en double hacen las mismas cuentas que evaluate. No vale
+  // para Mandelbulb, cuyo kernel por lotes difiere de la forma
+  // trigonométrica en ~1e-8: ahí solo se exige la tolerancia --tol.
+  bool exact;
+};
+
+vector<NamedFunction> buildFunctions(int domain) {
+  double c = domain / 2.0;
+  double s = domain / 512.0;
+
+  vector<Point> centers = {
+    Point(200 * s, 256 * s, 256 * s),
+    Point(312 * s, 256 * s, 256 * s),
+    Point(256 * s, 200 * s, 300 * s),
+    Point(256 * s, 312 * s, 300 * s),
+    Point(256 * s, 256 * s, 200 * s)
+  };
+  vector<double> radii = {40.0 * s, 35.0 * s, 45.0 * s, 38.0 * s, 42.0 * s};
+
+  CsgExpr shape = Csg::smoothUnion(Csg::torus(0, 0, 0, 70.0 * s, 20.0 * s), Csg::sphere(0, 40.0 * s, 0, 35.0 * s), 10.0 * s);
+  shape = Csg::subtract(shape, Csg::box(0, 0, 0, 30.0 * s, 30.0 * s, 30.0 * s, 4.0 * s));
+  shape = Csg::translate(Csg::twist(shape, 0.01 / s), c, c, c);
+
+  vector<NamedFunction> functions;
+  functions.push_back({"sphere", unique_ptr<ImplicitFunction>(new Sphere(c, c, c, domain * (100.0 / 256.0))), 0.0, 0.0, true});
+  functions.push_back({"torus", unique_ptr<ImplicitFunction>(new TorusFunction(c, c, c, 70.0 * s, 20.0 * s)), 0.0, 0.0, true});
+  functions.push_back({"rounded_cube", unique_ptr<ImplicitFunction>(new RoundedCubeFunction(c, c, c, 150.0 * s, 15.0 * s)), 0.0, 0.0, true});
+  functions.push_back({"gyroid", unique_ptr<ImplicitFunction>(new GyroidFunction(c, c, c, 0.15 / s, 0.2)), 0.0, 0.0, true});
+  functions.push_back({"metaballs", unique_ptr<ImplicitFunction>(new MetaballFunction(centers, radii, 1.5)), 0.0, 0.0, true});
+  functions.push_back({"mandelbulb", unique_ptr<ImplicitFunction>(new MandelbulbFunction(1.25, 1.25, 1.25, 8.0, 15, 2.0)), 2.5, 0.0, false});
+  functions.push_back({"heart", unique_ptr<ImplicitFunction>(new HeartFunction(c, c, c, 100.0 * s)), 0.0, 0.0, true});
+  functions.push_back({"heart_simple", unique_ptr<ImplicitFunction>(new HeartFunctionSimple(c, c, c, 100.0 * s)), 0.0, 0.0, true});
+  functions.push_back({"complex_hybrid", unique_ptr<ImplicitFunction>(new ComplexHybridFunction(c, c, c, 0.5)), 0.0, 0.0, true});
+  functions.push_back({"csg", unique_ptr<ImplicitFunction>(new CsgFunction(shape)), 0.0, 0.0, true});
+  // Con iso = 0.2 la poda por bloques de Mandelbulb tiene que usar ese nivel;
+  // la referencia no poda
+  functions.push_back({"mandelbulb_iso", unique_ptr<ImplicitFunction>(new MandelbulbFunction(1.25, 1.25, 1.25, 8.0, 15, 2.0)), 2.5, 0.2, false});
+  return functions;
+}
+
+// Cómo se juzga cada motor
+struct Engine {
+  string name;
+  bool sameHash;       // Debe reproducir la referencia bit a bit
+  bool sameTriangles;  // Debe dar la misma cantidad de triángulos
+  double tolerance;    // Hausdorff máximo en unidades de delta
+};
+
+// Función y motor que no cumplen su tolerancia. heart en int16: el campo es
+// de grado 6 y casi plano sobre la superficie, así que 16 bits por bloque no
+// alcanzan para ubicar los cruces a menos de ~0.4 delta.
+const set<pair<string, string>> expectedFailures = {
+  {"heart", "int16"},
+};
+
+// Línea base: "función motor celdas_por_segundo" por línea
+map<pair<string, string>, double> readBaseline(const string &path) {
+  map<pair<string, string>, double> baseline;
+  ifstream in(path);
+  string field, engine;
+  double rate;
+  while (in >> field >> engine >> rate) baseline[make_pair(field, engine)] = rate;
+  return baseline;
+}
+
+// Memoria residente del proceso en bytes
+double residentBytes() {
+  ifstream statm("/proc/self/statm");
+  size_t total = 0, resident = 0;
+  statm >> total >> resident;
+  return (double)resident * sysconf(_SC_PAGESIZE);
+}
+
+// Genera varios frames seguidos con generateMeshParallel: a partir del
+// segundo las páginas tienen que salir del pool, así que ni las páginas
+// pedidas al sistema ni la memoria residente pueden crecer
+bool checkPageRecycling(int domain, int delta, int threads, int frames, string &summary) {
+  Sphere sphere(domain / 2.0, domain / 2.0, domain / 2.0, domain * (100.0 / 256.0));
+  MarchingCubes mc(domain, delta, "", &sphere);
+  mc.setThreads(max(2, threads));
+  size_t firstPages = 0, lastPages = 0;
+  double firstResident = 0.0, lastResident = 0.0;
+  for (int frame = 0; frame < frames; ++frame) {
+    mc.generateMeshParallel();
+    lastPages = MeshPagePool::allocated();
+    lastResident = residentBytes();
+    if (frame == 1) {
+      firstPages = lastPages;
+      firstResident = lastResident;
+    }
+  }
+  // Una página de margen en la memoria por la fragmentación del heap
+  bool ok = lastPages <= firstPages && lastResident <= firstResident + sizeof(MeshPage);
+  ostringstream line;
+  line << "Page pool over " << frames << " parallel frames: " << firstPages << " -> " << lastPages
+       << " allocated pages, RSS " << firstResident / 1e6 << " -> " << lastResident / 1e6 << " MB  "
+       << (ok ? "ok" : "growing");
+  summary = line.str();
+  return ok;
+}
+
+void removeDirectory(const string &path) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return;
+  while (dirent* entry = readdir(dir)) {
+    string name = entry->d_name;
+    if (name != "." && name != "..") unlink((path + "/" + name).c_str());
+  }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+int main(int argc, char** argv) {
+  int domain = 512;
+  int delta = 8;
+  int threads = max(1u, thread::hardware_concurrency());
+  int repeat = 3;
+  double tolerance = 1e-6, floatTolerance = 0.05, int16Tolerance = 0.25, trianglesTolerance = 1.0;
+  double maxRegression = 20.0;
+  string baselinePath, writeBaselinePath;
+
+  int positional = 0;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      if (positional++ == 0) domain = atoi(arg.c_str());
+      else delta = atoi(arg.c_str());
+      continue;
+    }
+    if (i + 1 >= argc) {
+      cerr << "Falta el valor de " << arg << "\n";
+      return 1;
+    }
+    string value = argv[++i];
+    if (arg == "--threads") threads = max(1, atoi(value.c_str()));
+    else if (arg == "--repeat") repeat = max(1, atoi(value.c_str()));
+    else if (arg == "--tol") tolerance = atof(value.c_str());
+    else if (arg == "--float-tol") floatTolerance = atof(value.c_str());
+    else if (arg == "--int16-tol") int16Tolerance = atof(value.c_str());
+    else if (arg == "--tris-tol") trianglesTolerance = atof(value.c_str());
+    else if (arg == "--baseline") baselinePath = value;
+    else if (arg == "--write-baseline") writeBaselinePath = value;
+    else if (arg == "--max-regression") maxRegression = atof(value.c_str());
+    else {
+      cerr << "Opción desconocida: " << arg << "\n";
+      return 1;
+    }
+  }
+
+  const vector<Engine> engines = {
+    {"reference", true, true, 0.0},
+    {"parallel", true, true, 0.0},
+    {"batch", true, true, tolerance},
+    {"cached", true, true, tolerance},
+    {"adaptive", true, true, tolerance},
+    {"float", false, false, floatTolerance},
+    {"int16", false, false, int16Tolerance},
+  };
+
+  char cacheTemplate[] = "/tmp/mc-validate-XXXXXX";
+  string cacheDirectory = mkdtemp(cacheTemplate) ? cacheTemplate : "";
+
+  map<pair<string, string>, double> baseline;
+  if (!baselinePath.empty()) baseline = readBaseline(baselinePath);
+  ostringstream measured;
+  double cells = pow((double)(domain / delta), 3);
+
+  vector<string> report;
+  int failures = 0;
+  for (auto &entry : buildFunctions(domain)) {
+    // Las funciones con extent propio se muestrean con la misma cantidad de celdas
+    double spacing = entry.extent > 0 ? entry.extent / (domain / delta) : delta;
+    auto engineFor = [&]() {
+      return entry.extent > 0 ? MarchingCubes(Point(entry.extent, entry.extent, entry.extent), spacing, "", entry.func.get())
+                              : MarchingCubes(domain, delta, "", entry.func.get());
+    };
+    MarchingCubes reference = engineFor();
+    reference.setIsoValue(entry.iso);
+    uint64_t referenceHash = 0;
+
+    for (const Engine &engine : engines) {
+      MarchingCubes mc = engineFor();
+      mc.setIsoValue(entry.iso);
+      mc.setThreads(threads);
+      MeshArena adaptive;
+      double best = INFINITY;
+
+      for (int r = 0; r < repeat; ++r) {
+        if (engine.name == "reference") {
+          reference.generateMesh();
+          best = min(best, reference.elapsedSeconds());
+          continue;
+        }
+        if (engine.name == "parallel") {
+          mc.generateMeshParallel();
+        } else if (engine.name == "batch") {
+          mc.generateMeshCached(Precision::Double);
+        } else if (engine.name == "cached") {
+          // La primera corrida llena el caché; se mide la que lo lee
+          if (r == 0) {
+            mc.setFieldCache(cacheDirectory);
+            mc.generateMeshCached(Precision::Double);
+          }
+          mc.generateMeshCached(Precision::Double);
+        } else if (engine.name == "adaptive") {
+          vector<MeshArena> meshes = mc.generateMeshes({entry.iso});
+          adaptive = move(meshes[0]);
+        } else if (engine.name == "float") {
+          mc.generateMeshCached(Precision::Float);
+        } else {
+          mc.generateMeshCached(Precision::Int16);
+        }
+        best = min(best, mc.elapsedSeconds());
+      }
+
+      const MeshArena &ref = reference.getMesh();
+      const MeshArena &mesh = engine.name == "reference" ? ref : engine.name == "adaptive" ? adaptive : mc.getMesh();
+      uint64_t hash = meshHash(mesh);
+      if (engine.name == "reference") referenceHash = hash;
+
+      // En ambos sentidos, para que una superficie perdida también cuente
+      double deviation = max(maxVertexDeviation(ref, mesh, spacing), maxVertexDeviation(mesh, ref, spacing)) / spacing;
+      double trianglesOff = ref.triangles() == 0 ? (mesh.triangles() == 0 ? 0.0 : 100.0)
+                            : 100.0 * fabs((double)mesh.triangles() - ref.triangles()) / ref.triangles();
+
+      vector<string> problems;
+      if (engine.sameHash && (entry.exact || engine.name == "parallel") && hash != referenceHash) problems.push_back("hash");
+      if (engine.sameTriangles ? mesh.triangles() != ref.triangles() : trianglesOff > trianglesTolerance) {
+        problems.push_back("triangles");
+      }
+      if (!(deviation <= engine.tolerance)) problems.push_back("hausdorff");
+
+      // Las fallas esperadas son de exactitud; el rendimiento se exige igual
+      bool expected = expectedFailures.count(make_pair(entry.name, engine.name)) > 0;
+      if (expected) {
+        failures += problems.empty();
+        string accuracy;
+        for (size_t p = 0; p < problems.size(); ++p) accuracy += (p ? "," : "") + problems[p];
+        problems = {problems.empty() ? "xpass" : "xfail(" + accuracy + ")"};
+      }
+
+      double rate = cells / best;
+      measured << entry.name << " " << engine.name << " " << rate << "\n";
+      auto base = baseline.find(make_pair(entry.name, engine.name));
+      double change = 0.0;
+      bool slow = false;
+      if (base != baseline.end()) {
+        change = 100.0 * (rate - base->second) / base->second;
+        slow = change < -maxRegression;
+        if (slow) problems.push_back("throughput");
+      }
+
+      string status = "ok";
+      for (size_t p = 0; p < problems.size(); ++p) status = (p ? status + "," : "") + problems[p];
+      failures += expected ? slow : !problems.empty();
+
+      ostringstream line;
+      line << left << setw(16) << entry.name << setw(11) << engine.name
+           << right << setw(10) << mesh.triangles()
+           << setw(18) << hex << hash << dec
+           << setw(12) << deviation
+           << setw(12) << setprecision(4) << rate / 1e6 << setprecision(6);
+      if (base != baseline.end()) line << setw(9) << showpos << fixed << setprecision(1) << change << "%" << noshowpos << defaultfloat << setprecision(6);
+      else line << setw(10) << "-";
+      line << "  " << status;
+      report.push_back(line.str());
+    }
+  }
+
+  if (!cacheDirectory.empty()) removeDirectory(cacheDirectory);
+
+  string recycling;
+  failures += !checkPageRecycling(domain, delta, threads, 6, recycling);
+
+  cout << "\n" << left << setw(16) << "function" << setw(11) << "engine"
+       << right << setw(10) << "tris" << setw(18) << "hash"
+       << setw(12) << "dev/delta" << setw(12) << "Mcells/s" << setw(10) << "vs base" << "  status\n";
+  for (const string &line : report) cout << line << "\n";
+  cout << "\n" << recycling << "\n";
+
+  if (!writeBaselinePath.empty()) {
+    ofstream out(writeBaselinePath);
+    out << measured.str();
+    cout << "\nBaseline written to " << writeBaselinePath << "\n";
+  }
+
+  cout << "\n" << (failures ? to_string(failures) + " checks failed." : string("All checks passed.")) << "\n";
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+#include "mc.h"
+
+#include <memory>
+
+// Escritores de mallas. Cada uno arma la salida en buffers contiguos (uno por
+// página de la malla o por flujo) y la escribe con pocas llamadas grandes;
+// con más de un hilo los buffers se arman en paralelo y se escriben con pwrite
+// en desplazamientos calculados de antemano.
+//
+// Los formatos binarios se escriben en el orden de bytes de la máquina, que se
+// asume little-endian como piden STL y el formato compacto.
+
+// Escribe los segmentos uno tras otro en filename
+inline bool writeSegments(const string &filename, const vector<string> &segments, int threads) {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+
+  vector<off_t> offsets(segments.size() + 1, 0);
+  for (size_t s = 0; s < segments.size(); ++s) offsets[s + 1] = offsets[s] + segments[s].size();
+
+  auto writeAll = [&](const string &data, off_t offset, bool positioned) {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t n = positioned ? pwrite(fd, data.data() + done, data.size() - done, offset + done)
+                             : write(fd, data.data() + done, data.size() - done);
+      if (n <= 0) return false;
+      done += n;
+    }
+    return true;
+  };
+
+  atomic<bool> ok(true);
+  if (threads <= 1) {
+    for (size_t s = 0; s < segments.size() && ok; ++s) ok = writeAll(segments[s], offsets[s], false);
+  } else {
+    // El tamaño final se fija primero para que ningún pwrite extienda el archivo
+    if (ftruncate(fd, offsets.back()) != 0) ok = false;
+    parallelFor(ok ? (int)segments.size() : 0, threads, [&](int s) {
+      if (!writeAll(segments[s], offsets[s], true)) ok = false;
+    });
+  }
+  if (::close(fd) != 0) ok = false;
+  return ok;
+}
+
+// Páginas de la malla con el índice global de su primer vértice, para poder
+// procesarlas por separado
+struct PageSpan {
+  const MeshPage* page;
+  size_t vertexBase;
+  size_t triangleBase;
+};
+
+inline vector<PageSpan> pageSpans(const MeshArena &mesh) {
+  vector<PageSpan> spans;
+  size_t vertexBase = 0, triangleBase = 0;
+  for (const MeshPage* page = mesh.pages(); page; page = page->next) {
+    spans.push_back({page, vertexBase, triangleBase});
+    vertexBase += page->vertexCount;
+    triangleBase += page->indexCount / 3;
+  }
+  return spans;
+}
+
+// Malla indexada con los vértices repetidos soldados: dos vértices con las
+// mismas coordenadas en float pasan a ser uno
+struct IndexedMesh {
+  vector<float> positions;   // x, y, z por vértice
+  vector<uint32_t> indices;  // 3 por triángulo
+
+  size_t vertices() const { return positions.size() / 3; }
+  size_t triangles() const { return indices.size() / 3; }
+};
+
+inline IndexedMesh weldMesh(const MeshArena &mesh) {
+  struct Key {
+    uint32_t bits[3];
+    bool operator==(const Key &o) const { return bits[0] == o.bits[0] && bits[1] == o.bits[1] && bits[2] == o.bits[2]; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      uint64_t h = k.bits[0] * 0x9E3779B97F4A7C15ull;
+      h ^= (h >> 29) + k.bits[1] * 0xBF58476D1CE4E5B9ull;
+      h ^= (h >> 31) + k.bits[2] * 0x94D049BB133111EBull;
+      return h ^ (h >> 32);
+    }
+  };
+
+  IndexedMesh out;
+  unordered_map<Key, uint32_t, KeyHash> ids;
+  ids.reserve(mesh.vertices() / 2);
+  vector<uint32_t> remap;
+  remap.reserve(mesh.vertices());
+  out.positions.reserve(mesh.vertices() * 3 / 2);
+
+  for (const MeshPage* page = mesh.pages(); page; page = page->next) {
+    for (int i = 0; i < page->vertexCount; ++i) {
+      const Point &p = page->vertices[i];
+      // + 0.0f unifica -0 y 0
+      float v[3] = {(float)p.X() + 0.0f, (float)p.Y() + 0.0f, (float)p.Z() + 0.0f};
+      Key key;
+      memcpy(key.bits, v, sizeof(v));
+      auto found = ids.emplace(key, (uint32_t)out.vertices());
+      if (found.second) out.positions.insert(out.positions.end(), v, v + 3);
+      remap.push_back(found.first->second);
+    }
+  }
+
+  out.indices.reserve(mesh.triangles() * 3);
+  mesh.forEachTriangle([&](size_t a, size_t b, size_t c) {
+    out.indices.insert(out.indices.end(), {remap[a], remap[b], remap[c]});
+  });
+  return out;
+}
+
+// Reordena los triángulos para aprovechar una caché de vértices de cacheSize
+// entradas (Tipsify: Sander, Nehab y Barczak, 2007). Se mantiene la orientación
+// de cada triángulo.
+inline void optimizeVertexCache(IndexedMesh &mesh, int cacheSize = 16) {
+  size_t vertexCount = mesh.vertices();
+  size_t triangleCount = mesh.triangles();
+  const vector<uint32_t> &in = mesh.indices;
+
+  // Triángulos de cada vértice en formato CSR
+  vector<uint32_t> start(vertexCount + 1, 0);
+  for (uint32_t v : in) ++start[v + 1];
+  for (size_t v = 0; v < vertexCount; ++v) start[v + 1] += start[v];
+  vector<uint32_t> adjacency(in.size());
+  vector<uint32_t> fill(start.begin(), start.end() - 1);
+  for (size_t n = 0; n < in.size(); ++n) adjacency[fill[in[n]]++] = n / 3;
+
+  vector<int> live(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) live[v] = start[v + 1] - start[v];
+  vector<long long> stamp(vertexCount, 0);
+  vector<char> emitted(triangleCount, 0);
+  vector<uint32_t> deadEnd;
+  vector<uint32_t> out;
+  out.reserve(in.size());
+
+  long long time = cacheSize + 1;
+  size_t cursor = 0;
+  long long fan = vertexCount ? 0 : -1;
+  vector<uint32_t> candidates;
+
+  while (fan >= 0) {
+    candidates.clear();
+    for (uint32_t a = start[fan]; a < start[fan + 1]; ++a) {
+      uint32_t t = adjacency[a];
+      if (emitted[t]) continue;
+      for (int c = 0; c < 3; ++c) {
+        uint32_t v = in[3 * t + c];
+        out.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        --live[v];
+        if (time - stamp[v] > cacheSize) stamp[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    // Siguiente abanico: el candidato que seguirá en caché y más tiempo lleva
+    fan = -1;
+    long long best = -1;
+    for (uint32_t v : candidates) {
+      if (live[v] <= 0) continue;
+      long long priority = 0;
+      if (time - stamp[v] + 2 * live[v] <= cacheSize) priority = time - stamp[v];
+      if (priority > best) {
+        best = priority;
+        fan = v;
+      }
+    }
+    // Sin candidatos: el último vértice vivo usado, o el siguiente en orden
+    while (fan < 0 && !deadEnd.empty()) {
+      uint32_t v = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[v] > 0) fan = v;
+    }
+    while (fan < 0 && cursor < vertexCount) {
+      if (live[cursor] > 0) fan = cursor;
+      ++cursor;
+    }
+  }
+
+  mesh.indices.swap(out);
+}
+
+// Renumera los vértices en el orden en que los usa el índice, para que los
+// vértices consecutivos estén cerca en memoria y en el espacio
+inline void optimizeVertexFetch(IndexedMesh &mesh) {
+  vector<uint32_t> remap(mesh.vertices(), UINT32_MAX);
+  vector<float> positions;
+  positions.reserve(mesh.positions.size());
+  for (uint32_t &v : mesh.indices) {
+    if (remap[v] == UINT32_MAX) {
+      remap[v] = positions.size() / 3;
+      positions.insert(positions.end(), &mesh.positions[3 * v], &mesh.positions[3 * v] + 3);
+    }
+    v = remap[v];
+  }
+  mesh.positions.swap(positions);
+}
+
+inline void putVarint(string &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+inline bool getVarint(const uint8_t* &in, const uint8_t* end, uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35 && in < end; shift += 7) {
+    uint8_t byte = *in++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+template <typename T>
+inline void putRaw(string &out, const T &value) {
+  out.append((const char*)&value, sizeof(T));
+}
+
+// Formato compacto (.mcz), pensado para transmitir la malla:
+//   "MCZ1", uint32 vértices, uint32 triángulos,
+//   float mínimo[3], float paso[3], uint32 bytes de vértices, uint32 bytes de índices,
+//   vértices: por eje, diferencia con el vértice anterior de la posición
+//             cuantizada a 16 bits (p = mínimo + q * paso), zigzag y varint,
+//   índices:  (mayor índice visto + 1) - índice, en varint; con los vértices en
+//             orden de primer uso un vértice nuevo cuesta un byte.
+const char MCZ_MAGIC[4] = {'M', 'C', 'Z', '1'};
+const int MCZ_HEADER = 4 + 2 * 4 + 6 * 4 + 2 * 4;
+
+inline void encodeCompactVertices(const IndexedMesh &mesh, const float minimum[3], const float step[3], string &out) {
+  int32_t previous[3] = {0, 0, 0};
+  for (size_t v = 0; v < mesh.vertices(); ++v) {
+    for (int a = 0; a < 3; ++a) {
+      int32_t q = (int32_t)lround((mesh.positions[3 * v + a] - minimum[a]) / step[a]);
+      q = max(0, min(65535, q));
+      int32_t delta = q - previous[a];
+      putVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+      previous[a] = q;
+    }
+  }
+}
+
+// Requiere los vértices en orden de primer uso (optimizeVertexFetch): ningún
+// índice supera al mayor visto + 1
+inline void encodeCompactIndices(const IndexedMesh &mesh, string &out) {
+  uint32_t next = 0;
+  for (uint32_t v : mesh.indices) {
+    putVarint(out, next - v);
+    next = max(next, v + 1);
+  }
+}
+
+// Lee un archivo .mcz; devuelve false si no es válido
+inline bool readCompactMesh(const string &filename, IndexedMesh &mesh) {
+  ifstream in(filename, ios::binary);
+  string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  if (data.size() < (size_t)MCZ_HEADER || memcmp(data.data(), MCZ_MAGIC, 4) != 0) return false;
+
+  uint32_t counts[2], sizes[2];
+  float minimum[3], step[3];
+  const char* p = data.data() + 4;
+  memcpy(counts, p, sizeof(counts)); p += sizeof(counts);
+  memcpy(minimum, p, sizeof(minimum)); p += sizeof(minimum);
+  memcpy(step, p, sizeof(step)); p += sizeof(step);
+  memcpy(sizes, p, sizeof(sizes)); p += sizeof(sizes);
+  if ((size_t)MCZ_HEADER + sizes[0] + sizes[1] != data.size()) return false;
+  // Cada varint ocupa al menos un byte: no reservar más de lo que el archivo
+  // puede contener
+  if ((uint64_t)counts[0] * 3 > sizes[0] || (uint64_t)counts[1] * 3 > sizes[1]) return false;
+
+  const uint8_t* cur = (const uint8_t*)p;
+  const uint8_t* end = cur + sizes[0];
+  mesh.positions.resize((size_t)counts[0] * 3);
+  int32_t previous[3] = {0, 0, 0};
+  for (size_t v = 0; v < counts[0]; ++v) {
+    for (int a = 0; a < 3; ++a) {
+      uint32_t z;
+      if (!getVarint(cur, end, z)) return false;
+      previous[a] += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+      mesh.positions[3 * v + a] = minimum[a] + previous[a] * step[a];
+    }
+  }
+
+  // Los vértices tienen que ocupar exactamente su sección
+  if (cur != (const uint8_t*)p + sizes[0]) return false;
+  end = cur + sizes[1];
+  mesh.indices.resize((size_t)counts[1] * 3);
+  uint32_t next = 0;
+  for (uint32_t &v : mesh.indices) {
+    uint32_t code;
+    if (!getVarint(cur, end, code) || code > next) return false;
+    v = next - code;
+    if (v >= counts[0]) return false;
+    next = max(next, v + 1);
+  }
+  return cur == end;
+}
+
+class MeshWriter {
+public:
+  virtual ~MeshWriter() {}
+
+  virtual const char* extension() const = 0;
+
+  // Con threads > 1 arma los buffers en paralelo y los escribe con pwrite
+  virtual bool write(const MeshArena &mesh, const string &filename, int threads = 1) const = 0;
+
+  // nullptr si el formato no existe
+  static unique_ptr<MeshWriter> create(const string &format);
+};
+
+// PLY ASCII
+class PlyWriter : public MeshWriter {
+public:
+  const char* extension() const override { return "ply"; }
+
+  bool write(const MeshArena &mesh, const string &filename, int threads = 1) const override {
+    vector<PageSpan> spans = pageSpans(mesh);
+    size_t pages = spans.size();
+    vector<string> segments(1 + 2 * pages);
+
+    ostringstream header;
+    header << "ply\n"
+           << "format ascii 1.0\n"
+           << "element vertex " << mesh.vertices() << "\n"
+           << "property float x\n"
+           << "property float y\n"
+           << "property float z\n"
+           << "element face " << mesh.triangles() << "\n"
+           << "property list uchar int vertex_indices\n"
+           << "end_header\n";
+    segments[0] = header.str();
+
+    // Los vértices de todas las páginas van antes que las caras
+    parallelFor((int)pages, threads, [&](int s) {
+      // %g da el mismo texto que operator<< con la precisión por defecto
+      const MeshPage* page = spans[s].page;
+      string &vertices = segments[1 + s];
+      string &faces = segments[1 + pages + s];
+      char line[128];
+      for (int i = 0; i < page->vertexCount; i++) {
+        const Point &p = page->vertices[i];
+        vertices.append(line, snprintf(line, sizeof(line), "%g %g %g\n", p.X(), p.Y(), p.Z()));
+      }
+      size_t base = spans[s].vertexBase;
+      for (int i = 0; i < page->indexCount; i += 3) {
+        faces.append(line, snprintf(line, sizeof(line), "3 %zu %zu %zu\n", base + page->indices[i],
+                                    base + page->indices[i + 1], base + page->indices[i + 2]));
+      }
+    });
+
+    return writeSegments(filename, segments, threads);
+  }
+};
+
+// STL binario: cabecera de 80 bytes, cantidad de triángulos y 50 bytes por
+// triángulo, así que cada página sabe de antemano dónde va
+class StlWriter : public MeshWriter {
+public:
+  const char* extension() const override { return "stl"; }
+
+  bool write(const MeshArena &mesh, const string &filename, int threads = 1) const override {
+    vector<PageSpan> spans = pageSpans(mesh);
+    vector<string> segments(1 + spans.size());
+
+    segments[0].assign(80, '\0');
+    segments[0].replace(0, 22, "marching cubes mesh   ");
+    putRaw(segments[0], (uint32_t)mesh.triangles());
+
+    parallelFor((int)spans.size(), threads, [&](int s) {
+      const MeshPage* page = spans[s].page;
+      string &out = segments[1 + s];
+      out.resize((size_t)page->indexCount / 3 * 50);
+      char* cursor = &out[0];
+      for (int i = 0; i < page->indexCount; i += 3) {
+        const Point &a = page->vertices[page->indices[i]];
+        const Point &b = page->vertices[page->indices[i + 1]];
+        const Point &c = page->vertices[page->indices[i + 2]];
+        Point u = b - a, v = c - a;
+        double nx = u.Y() * v.Z() - u.Z() * v.Y();
+        double ny = u.Z() * v.X() - u.X() * v.Z();
+        double nz = u.X() * v.Y() - u.Y() * v.X();
+        double length = sqrt(nx * nx + ny * ny + nz * nz);
+        if (length > 0) {
+          nx /= length;
+          ny /= length;
+          nz /= length;
+        }
+        float record[12] = {(float)nx, (float)ny, (float)nz,
+                            (float)a.X(), (float)a.Y(), (float)a.Z(),
+                            (float)b.X(), (float)b.Y(), (float)b.Z(),
+                            (float)c.X(), (float)c.Y(), (float)c.Z()};
+        memcpy(cursor, record, sizeof(record));
+        memset(cursor + sizeof(record), 0, 2);
+        cursor += 50;
+      }
+    });
+
+    return writeSegments(filename, segments, threads);
+  }
+};
+
+// OBJ con los vértices soldados, así los triángulos vecinos comparten índices
+class ObjWriter : public MeshWriter {
+public:
+  const char* extension() const override { return "obj"; }
+
+  bool write(const MeshArena &mesh, const string &filename, int threads = 1) const override {
+    IndexedMesh indexed = weldMesh(mesh);
+    const size_t chunk = 32768;
+    int vertexChunks = (indexed.vertices() + chunk - 1) / chunk;
+    int triangleChunks = (indexed.triangles() + chunk - 1) / chunk;
+    vector<string> segments(vertexChunks + triangleChunks);
+
+    parallelFor(vertexChunks + triangleChunks, threads, [&](int s) {
+      string &out = segments[s];
+      char line[128];
+      if (s < vertexChunks) {
+        size_t last = min(indexed.vertices(), (s + 1) * chunk);
+        for (size_t v = s * chunk; v < last; ++v) {
+          const float* p = &indexed.positions[3 * v];
+          out.append(line, snprintf(line, sizeof(line), "v %g %g %g\n", p[0], p[1], p[2]));
+        }
+      } else {
+        size_t first = (s - vertexChunks) * chunk;
+        size_t last = min(indexed.triangles(), first + chunk);
+        // OBJ cuenta desde 1
+        for (size_t t = first; t < last; ++t) {
+          const uint32_t* f = &indexed.indices[3 * t];
+          out.append(line, snprintf(line, sizeof(line), "f %u %u %u\n", f[0] + 1, f[1] + 1, f[2] + 1));
+        }
+      }
+    });
+
+    return writeSegments(filename, segments, threads);
+  }
+};
+
+// Formato compacto descrito arriba de encodeCompactVertices
+class CompactWriter : public MeshWriter {
+public:
+  const char* extension() const override { return "mcz"; }
+
+  bool write(const MeshArena &mesh, const string &filename, int threads = 1) const override {
+    IndexedMesh indexed = weldMesh(mesh);
+    optimizeVertexCache(indexed);
+    optimizeVertexFetch(indexed);
+
+    float minimum[3] = {0, 0, 0}, maximum[3] = {0, 0, 0}, step[3];
+    for (int a = 0; a < 3; ++a) {
+      if (indexed.vertices() == 0) break;
+      minimum[a] = maximum[a] = indexed.positions[a];
+      for (size_t v = 1; v < indexed.vertices(); ++v) {
+        minimum[a] = min(minimum[a], indexed.positions[3 * v + a]);
+        maximum[a] = max(maximum[a], indexed.positions[3 * v + a]);
+      }
+    }
+    for (int a = 0; a < 3; ++a) step[a] = maximum[a] > minimum[a] ? (maximum[a] - minimum[a]) / 65535.0f : 1.0f;
+
+    // Los dos flujos son independientes
+    vector<string> segments(3);
+    parallelFor(2, threads, [&](int s) {
+      if (s == 0) encodeCompactVertices(indexed, minimum, step, segments[1]);
+      else encodeCompactIndices(indexed, segments[2]);
+    });
+
+    string &header = segments[0];
+    header.append(MCZ_MAGIC, 4);
+    putRaw(header, (uint32_t)indexed.vertices());
+    putRaw(header, (uint32_t)indexed.triangles());
+    for (int a = 0; a < 3; ++a) putRaw(header, minimum[a]);
+    for (int a = 0; a < 3; ++a) putRaw(header, step[a]);
+    putRaw(header, (uint32_t)segments[1].size());
+    putRaw(header, (uint32_t)segments[2].size());
+
+    return writeSegments(filename, segments, threads);
+  }
+};
+
+inline unique_ptr<MeshWriter> MeshWriter::create(const string &format) {
+  if (format == "ply") return unique_ptr<MeshWriter>(new PlyWriter());
+  if (format == "stl") return unique_ptr<MeshWriter>(new StlWriter());
+  if (format == "obj") return unique_ptr<MeshWriter>(new ObjWriter());
+  if (format == "mcz") return unique_ptr<MeshWriter>(new CompactWriter());
+  return nullptr;
+}